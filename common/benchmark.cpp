@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "benchmark.h"
+#include "nvh/nvprint.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+
+float BenchmarkScenario::getParam(const std::string& key, float defaultValue) const
+{
+  auto it = params.find(key);
+  return it != params.end() ? it->second : defaultValue;
+}
+
+bool BenchmarkScenario::getCamera(float time, CameraKey& key) const
+{
+  if(camera.empty())
+    return false;
+
+  auto next = std::upper_bound(camera.begin(), camera.end(), time,
+                               [](float t, const CameraKey& k) { return t < k.time; });
+  if(next == camera.begin() || next == camera.end())
+  {
+    key = next == camera.begin() ? camera.front() : camera.back();
+    return true;
+  }
+
+  const CameraKey& prev = *(next - 1);
+  const float      t    = (time - prev.time) / std::max(next->time - prev.time, 1e-6f);
+  key.time              = time;
+  key.eye               = prev.eye + (next->eye - prev.eye) * t;
+  key.center            = prev.center + (next->center - prev.center) * t;
+  key.up                = prev.up + (next->up - prev.up) * t;
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reading the scenario file, see benchmark.h for the format
+//
+bool loadBenchmarkScenario(const std::string& filename, BenchmarkScenario& scenario)
+{
+  std::ifstream in(filename);
+  if(!in)
+  {
+    LOGE("Benchmark: cannot open %s\n", filename.c_str());
+    return false;
+  }
+
+  std::string line;
+  int         lineNumber = 0;
+  while(std::getline(in, line))
+  {
+    lineNumber++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::string        key;
+    if(!(words >> key))
+      continue;
+
+    bool valid = true;
+    if(key == "name")
+      valid = bool(words >> scenario.name);
+    else if(key == "scene")
+      valid = bool(words >> scenario.scene);
+    else if(key == "resolution")
+      valid = bool(words >> scenario.width >> scenario.height) && scenario.width > 0 && scenario.height > 0;
+    else if(key == "warmup")
+      valid = bool(words >> scenario.warmupFrames);
+    else if(key == "frames")
+      valid = bool(words >> scenario.measuredFrames) && scenario.measuredFrames > 0;
+    else if(key == "seed")
+      valid = bool(words >> scenario.seed);
+    else if(key == "frameTime")
+      valid = bool(words >> scenario.frameTime) && scenario.frameTime > 0;
+    else if(key == "param")
+    {
+      std::string param;
+      float       value;
+      valid = bool(words >> param >> value);
+      if(valid)
+        scenario.params[param] = value;
+    }
+    else if(key == "camera")
+    {
+      BenchmarkScenario::CameraKey cam;
+      valid = bool(words >> cam.time >> cam.eye.x >> cam.eye.y >> cam.eye.z >> cam.center.x >> cam.center.y
+                   >> cam.center.z >> cam.up.x >> cam.up.y >> cam.up.z);
+      if(valid)
+        scenario.camera.push_back(cam);
+    }
+    else
+      valid = false;
+
+    if(!valid)
+    {
+      LOGE("Benchmark: %s(%d): invalid line '%s'\n", filename.c_str(), lineNumber, line.c_str());
+      return false;
+    }
+  }
+
+  std::stable_sort(scenario.camera.begin(), scenario.camera.end(),
+                   [](const BenchmarkScenario::CameraKey& a, const BenchmarkScenario::CameraKey& b) { return a.time < b.time; });
+  if(scenario.name.empty())
+    scenario.name = filename;
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// The budget properties are physical-device-level, they only need the extension to be supported
+//
+bool getDeviceMemoryUsage(VkPhysicalDevice physicalDevice, VkDeviceSize& usage, VkDeviceSize& budget)
+{
+  uint32_t count{0};
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> extensions(count);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+  bool supported = std::any_of(extensions.begin(), extensions.end(), [](const VkExtensionProperties& e) {
+    return strcmp(e.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+  });
+  if(!supported)
+    return false;
+
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+  VkPhysicalDeviceMemoryProperties2 memProps{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2};
+  memProps.pNext = &budgetProps;
+  vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memProps);
+
+  usage  = 0;
+  budget = 0;
+  for(uint32_t i = 0; i < memProps.memoryProperties.memoryHeapCount; i++)
+  {
+    if((memProps.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0)
+      continue;
+    usage += budgetProps.heapUsage[i];
+    budget += budgetProps.heapBudget[i];
+  }
+  return true;
+}
+
+
+namespace {
+std::string jsonString(const std::string& str)
+{
+  std::string result = "\"";
+  for(char c : str)
+  {
+    if(c == '"' || c == '\\')
+      result += '\\';
+    result += c;
+  }
+  return result + "\"";
+}
+
+void writeTimes(std::ostream& out, const std::vector<float>& times)
+{
+  std::vector<float> sorted = times;
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0;
+  for(float t : sorted)
+    sum += t;
+  const size_t p99 = std::min(sorted.size() - 1, static_cast<size_t>(std::ceil(0.99 * sorted.size())) - 1);
+
+  out << "{\"minMs\": " << sorted.front() << ", \"meanMs\": " << sum / sorted.size() << ", \"p99Ms\": " << sorted[p99]
+      << ", \"maxMs\": " << sorted.back() << "}";
+}
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// Writing the scenario settings and the statistics of the measured frames
+//
+bool writeBenchmarkJson(const std::string& filename, const BenchmarkScenario& scenario, const VkExtent2D& size, const BenchmarkResults& results)
+{
+  std::ofstream out(filename);
+  if(!out)
+  {
+    LOGE("Benchmark: cannot write %s\n", filename.c_str());
+    return false;
+  }
+
+  out << "{\n";
+  out << "  \"name\": " << jsonString(scenario.name) << ",\n";
+  out << "  \"scene\": " << jsonString(scenario.scene) << ",\n";
+  out << "  \"resolution\": [" << size.width << ", " << size.height << "],\n";
+  out << "  \"seed\": " << scenario.seed << ",\n";
+  out << "  \"warmupFrames\": " << scenario.warmupFrames << ",\n";
+  out << "  \"measuredFrames\": " << results.frameMs.size() << ",\n";
+  out << "  \"params\": {";
+  for(auto it = scenario.params.begin(); it != scenario.params.end(); ++it)
+    out << (it == scenario.params.begin() ? "" : ", ") << jsonString(it->first) << ": " << it->second;
+  out << "},\n";
+
+  if(!results.frameMs.empty())
+  {
+    out << "  \"cpuFrame\": ";
+    writeTimes(out, results.frameMs);
+    out << ",\n  \"cpuRecord\": ";
+    writeTimes(out, results.recordMs);
+    out << ",\n";
+  }
+
+  out << "  \"gpu\": {";
+  for(size_t i = 0; i < results.gpu.size(); i++)
+  {
+    const BenchmarkResults::GpuTiming& timing = results.gpu[i];
+    out << (i == 0 ? "\n" : ",\n") << "    " << jsonString(timing.name) << ": {\"minMs\": " << timing.minMs
+        << ", \"meanMs\": " << timing.meanMs << ", \"p99Ms\": " << timing.p99Ms << "}";
+  }
+  out << (results.gpu.empty() ? "},\n" : "\n  },\n");
+
+  if(results.hasMemory)
+    out << "  \"memory\": {\"deviceLocalUsageMB\": " << results.memoryUsage / (1024.0 * 1024.0)
+        << ", \"deviceLocalBudgetMB\": " << results.memoryBudget / (1024.0 * 1024.0) << "}\n";
+  else
+    out << "  \"memory\": null\n";
+  out << "}\n";
+  return out.good();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include "nvmath/nvmath.h"
+#include <vulkan/vulkan_core.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+//--------------------------------------------------------------------------------------------------
+// Benchmark scenario, read from a text file with one setting per line ('#' starts a comment):
+//
+//   name       cornell_beams
+//   scene      media/scenes/cornellBox.gltf      # Replaces the scene of the sample
+//   resolution 1280 720
+//   warmup     10                                # Frames rendered before measuring
+//   frames     200                               # Measured frames
+//   seed       1234                              # Seed of the random generators of the sample
+//   frameTime  0.0166667                         # Time step of animations and of the camera path
+//   param      photons 32768                     # Sample specific values, e.g. sample counts
+//   camera     0.0  0 0 15  0 0 0  0 1 0         # time, eye, center, up
+//   camera     2.0  5 2 12  0 0 0  0 1 0
+//
+// The camera is interpolated linearly between the keys, and stays on the first key during warm-up.
+//
+struct BenchmarkScenario
+{
+  struct CameraKey
+  {
+    float         time{0};
+    nvmath::vec3f eye{0, 0, 0};
+    nvmath::vec3f center{0, 0, 0};
+    nvmath::vec3f up{0, 1, 0};
+  };
+
+  std::string                  name;
+  std::string                  scene;     // Only used by photon_beam
+  uint32_t                     width{0};  // 0: size of the sample window
+  uint32_t                     height{0};
+  uint32_t                     warmupFrames{10};
+  uint32_t                     measuredFrames{100};
+  uint32_t                     seed{1};
+  float                        frameTime{1.f / 60.f};
+  std::map<std::string, float> params;
+  std::vector<CameraKey>       camera;  // Sorted by time
+
+  float getParam(const std::string& key, float defaultValue) const;
+
+  // Camera of the path at `time`, false when the scenario has no camera keys
+  bool getCamera(float time, CameraKey& key) const;
+};
+
+bool loadBenchmarkScenario(const std::string& filename, BenchmarkScenario& scenario);
+
+
+//--------------------------------------------------------------------------------------------------
+// Measures of the frames after warm-up
+//
+struct BenchmarkResults
+{
+  struct GpuTiming
+  {
+    std::string name;
+    float       minMs{0};
+    float       meanMs{0};
+    float       p99Ms{0};
+  };
+
+  std::vector<float>     frameMs;   // CPU wall time of each frame: recording, submission and wait
+  std::vector<float>     recordMs;  // CPU time spent recording the command buffer
+  std::vector<GpuTiming> gpu;       // Whole frame, then the passes of the sample profiler
+
+  bool         hasMemory{false};  // VK_EXT_memory_budget supported
+  VkDeviceSize memoryUsage{0};    // Device local heaps, at the end of the run
+  VkDeviceSize memoryBudget{0};
+};
+
+// Usage and budget of the device local heaps, false when VK_EXT_memory_budget is not supported
+bool getDeviceMemoryUsage(VkPhysicalDevice physicalDevice, VkDeviceSize& usage, VkDeviceSize& budget);
+
+bool writeBenchmarkJson(const std::string& filename, const BenchmarkScenario& scenario, const VkExtent2D& size, const BenchmarkResults& results);
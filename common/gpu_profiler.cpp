@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gpu_profiler.h"
+#include "imgui.h"
+#include "nvh/nvprint.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t maxSections, uint32_t frameLatency)
+{
+  m_device      = device;
+  m_maxSections = maxSections;
+  m_frame       = 0;
+  m_slots.assign(frameLatency, FrameQueries());
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  m_timestampPeriod = properties.limits.timestampPeriod;
+
+  uint32_t familyCount{0};
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+  const uint32_t validBits = families[queueFamily].timestampValidBits;
+  if(validBits == 0)
+  {
+    LOGW("GpuProfiler: timestamps are not supported on this queue, GPU times are disabled\n");
+    return;
+  }
+  m_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+  VkQueryPoolCreateInfo createInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  createInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+  createInfo.queryCount = frameLatency * maxSections * 2;
+  vkCreateQueryPool(m_device, &createInfo, nullptr, &m_queryPool);
+}
+
+void GpuProfiler::deinit()
+{
+  vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+  m_queryPool = VK_NULL_HANDLE;
+  m_slots.clear();
+  m_sections.clear();
+  m_sectionIds.clear();
+  m_history.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reading the times of the frame previously using this range of queries, then resetting them
+//
+void GpuProfiler::beginFrame(const VkCommandBuffer& cmdBuf)
+{
+  if(m_queryPool == VK_NULL_HANDLE)
+    return;
+
+  m_currentSlot       = static_cast<uint32_t>(m_frame % m_slots.size());
+  FrameQueries& frame = m_slots[m_currentSlot];
+  resolve(frame, false);
+
+  vkCmdResetQueryPool(cmdBuf, m_queryPool, m_currentSlot * m_maxSections * 2, m_maxSections * 2);
+  frame.frame   = m_frame++;
+  frame.pending = true;
+  frame.sections.clear();
+}
+
+void GpuProfiler::beginSection(const std::string& name, const VkCommandBuffer& cmdBuf)
+{
+  if(m_queryPool == VK_NULL_HANDLE || m_slots[m_currentSlot].sections.size() >= m_maxSections)
+    return;
+
+  FrameQueries&  frame = m_slots[m_currentSlot];
+  const uint32_t query = (m_currentSlot * m_maxSections + uint32_t(frame.sections.size())) * 2;
+  frame.sections.push_back(getSectionId(name));
+  vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, query);
+}
+
+void GpuProfiler::endSection(const std::string& name, const VkCommandBuffer& cmdBuf)
+{
+  if(m_queryPool == VK_NULL_HANDLE)
+    return;
+
+  // Last section opened with this name
+  FrameQueries&  frame = m_slots[m_currentSlot];
+  const uint32_t id    = getSectionId(name);
+  for(size_t i = frame.sections.size(); i-- > 0;)
+  {
+    if(frame.sections[i] == id)
+    {
+      const uint32_t query = (m_currentSlot * m_maxSections + uint32_t(i)) * 2 + 1;
+      vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, query);
+      return;
+    }
+  }
+}
+
+void GpuProfiler::flush()
+{
+  // Oldest frame first, to keep the history in order
+  for(size_t i = 1; i <= m_slots.size(); i++)
+    resolve(m_slots[(m_currentSlot + i) % m_slots.size()], true);
+}
+
+void GpuProfiler::resetStats()
+{
+  for(auto& section : m_sections)
+  {
+    section.window.clear();
+    section.next = 0;
+    section.last = 0;
+  }
+  m_history.clear();
+}
+
+std::vector<std::string> GpuProfiler::getSectionNames() const
+{
+  std::vector<std::string> names;
+  for(const auto& section : m_sections)
+    names.push_back(section.name);
+  return names;
+}
+
+uint32_t GpuProfiler::getSectionId(const std::string& name)
+{
+  auto it = m_sectionIds.find(name);
+  if(it != m_sectionIds.end())
+    return it->second;
+
+  Section section;
+  section.name = name;
+  m_sections.push_back(section);
+  m_sectionIds[name] = uint32_t(m_sections.size() - 1);
+  return uint32_t(m_sections.size() - 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Getting the timestamps of a recorded frame. Without waiting, the frame is skipped when the results
+// are not available yet: its queries are reset when the range is reused.
+//
+void GpuProfiler::resolve(FrameQueries& queries, bool wait)
+{
+  if(!queries.pending)
+    return;
+  queries.pending = false;
+  if(queries.sections.empty())
+    return;
+
+  const uint32_t        slot       = static_cast<uint32_t>(&queries - m_slots.data());
+  const uint32_t        queryCount = uint32_t(queries.sections.size()) * 2;
+  std::vector<uint64_t> results(queryCount * 2);  // Value and availability of each query
+  VkQueryResultFlags    flags = VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+  if(wait)
+    flags |= VK_QUERY_RESULT_WAIT_BIT;
+  vkGetQueryPoolResults(m_device, m_queryPool, slot * m_maxSections * 2, queryCount, results.size() * sizeof(uint64_t),
+                        results.data(), 2 * sizeof(uint64_t), flags);
+
+  FrameTimes times;
+  times.frame = queries.frame;
+  times.times.assign(m_sections.size(), -1.f);
+  for(size_t i = 0; i < queries.sections.size(); i++)
+  {
+    const uint64_t* begin = &results[i * 4];
+    const uint64_t* end   = &results[i * 4 + 2];
+    if(begin[1] == 0 || end[1] == 0)
+      continue;
+
+    const uint64_t ticks = (end[0] - begin[0]) & m_timestampMask;
+    const float    ms    = float(double(ticks) * m_timestampPeriod / 1e6);
+
+    // Sections recorded several times in a frame are added up
+    float& frameTime = times.times[queries.sections[i]];
+    frameTime        = std::max(frameTime, 0.f) + ms;
+  }
+
+  for(uint32_t id = 0; id < uint32_t(m_sections.size()); id++)
+  {
+    if(times.times[id] < 0.f)
+      continue;
+    Section& section = m_sections[id];
+    if(section.window.size() < m_windowSize)
+      section.window.push_back(times.times[id]);
+    else
+      section.window[section.next] = times.times[id];
+    section.next = (section.next + 1) % m_windowSize;
+    section.last = times.times[id];
+  }
+
+  if(m_keepHistory)
+    m_history.emplace_back(std::move(times));
+}
+
+bool GpuProfiler::getStats(const std::string& name, Stats& stats) const
+{
+  auto it = m_sectionIds.find(name);
+  if(it == m_sectionIds.end() || m_sections[it->second].window.empty())
+    return false;
+
+  std::vector<float> sorted = m_sections[it->second].window;
+  std::sort(sorted.begin(), sorted.end());
+  const size_t p99 = static_cast<size_t>(std::ceil(0.99 * sorted.size())) - 1;
+
+  stats.minMs  = sorted.front();
+  stats.p99Ms  = sorted[std::min(p99, sorted.size() - 1)];
+  stats.lastMs = m_sections[it->second].last;
+  stats.meanMs = 0;
+  for(float t : sorted)
+    stats.meanMs += t;
+  stats.meanMs /= float(sorted.size());
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Table of the GPU times, in milliseconds
+//
+void GpuProfiler::renderUI() const
+{
+  if(!ImGui::CollapsingHeader("GPU Timers"))
+    return;
+
+  if(m_queryPool == VK_NULL_HANDLE)
+  {
+    ImGui::Text("Not supported");
+    return;
+  }
+
+  ImGui::Text("%-16s %8s %8s %8s", "ms", "min", "mean", "p99");
+  for(const auto& section : m_sections)
+  {
+    Stats stats;
+    if(getStats(section.name, stats))
+      ImGui::Text("%-16s %8.3f %8.3f %8.3f", section.name.c_str(), stats.minMs, stats.meanMs, stats.p99Ms);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// One line per frame, one column per section in milliseconds, empty when not recorded
+//
+bool GpuProfiler::writeCsv(const std::string& filename) const
+{
+  std::ofstream out(filename);
+  if(!out)
+  {
+    LOGE("GpuProfiler: cannot write %s\n", filename.c_str());
+    return false;
+  }
+
+  out << "frame";
+  for(const auto& section : m_sections)
+    out << "," << section.name;
+  out << "\n";
+
+  for(const auto& times : m_history)
+  {
+    out << times.frame;
+    for(size_t id = 0; id < m_sections.size(); id++)
+    {
+      out << ",";
+      if(id < times.times.size() && times.times[id] >= 0.f)
+        out << times.times[id];
+    }
+    out << "\n";
+  }
+  return out.good();
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <vulkan/vulkan_core.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+//--------------------------------------------------------------------------------------------------
+// GPU timers using timestamp queries.
+//
+// Each frame uses its own range of the query pool. The results of a frame are read back when its range
+// is reused, `frameLatency` frames later, so the CPU never waits on the GPU.
+//
+// Usage:
+//  - beginFrame(cmdBuf) at the start of the frame command buffer, outside a render pass
+//  - beginSection("name", cmdBuf) / endSection("name", cmdBuf) around each pass
+//  - renderUI() shows min, mean and 99th percentile of the last frames
+//  - flush() then writeCsv() to get the time of every frame (m_keepHistory must be set)
+//
+class GpuProfiler
+{
+public:
+  struct Stats
+  {
+    float minMs{0};
+    float meanMs{0};
+    float p99Ms{0};
+    float lastMs{0};
+  };
+
+  void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t maxSections = 16, uint32_t frameLatency = 4);
+  void deinit();
+
+  void beginFrame(const VkCommandBuffer& cmdBuf);
+  void beginSection(const std::string& name, const VkCommandBuffer& cmdBuf);
+  void endSection(const std::string& name, const VkCommandBuffer& cmdBuf);
+
+  // Wait for the frames still in flight and gather their times
+  void flush();
+  // Forget the times gathered so far, e.g. after warm-up frames
+  void resetStats();
+
+  std::vector<std::string> getSectionNames() const;
+
+  bool getStats(const std::string& name, Stats& stats) const;
+  void renderUI() const;
+  bool writeCsv(const std::string& filename) const;
+
+  bool     m_keepHistory{false};  // Keep the times of all frames, for writeCsv
+  uint32_t m_windowSize{256};     // Number of frames used for the statistics
+
+private:
+  struct FrameQueries
+  {
+    uint64_t              frame{0};
+    std::vector<uint32_t> sections;  // Section id of each pair of queries
+    bool                  pending{false};
+  };
+
+  struct Section
+  {
+    std::string        name;
+    std::vector<float> window;  // Ring buffer of the last times in milliseconds
+    uint32_t           next{0};
+    float              last{0};
+  };
+
+  struct FrameTimes
+  {
+    uint64_t           frame{0};
+    std::vector<float> times;  // Per section id, negative when the section was not recorded
+  };
+
+  uint32_t getSectionId(const std::string& name);
+  void     resolve(FrameQueries& queries, bool wait);
+
+  VkDevice    m_device{VK_NULL_HANDLE};
+  VkQueryPool m_queryPool{VK_NULL_HANDLE};
+  uint32_t    m_maxSections{0};
+  float       m_timestampPeriod{1.f};  // Nanoseconds per tick
+  uint64_t    m_timestampMask{~0ull};
+  uint64_t    m_frame{0};
+  uint32_t    m_currentSlot{0};
+
+  std::vector<FrameQueries>                 m_slots;
+  std::vector<Section>                      m_sections;
+  std::unordered_map<std::string, uint32_t> m_sectionIds;
+  std::vector<FrameTimes>                   m_history;
+};
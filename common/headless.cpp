@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "headless.h"
+#include "backends/imgui_impl_glfw.h"
+#include "nvh/cameramanipulator.hpp"
+#include "nvh/nvprint.hpp"
+#include "nvvk/commands_vk.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+
+//--------------------------------------------------------------------------------------------------
+// Reading the headless arguments, other arguments are ignored
+//
+HeadlessOptions parseHeadlessOptions(int argc, char** argv, uint32_t defaultWidth, uint32_t defaultHeight)
+{
+  HeadlessOptions options;
+  options.width  = defaultWidth;
+  options.height = defaultHeight;
+  for(int i = 1; i < argc; i++)
+  {
+    const bool hasValue = i + 1 < argc;
+    if(strcmp(argv[i], "--headless") == 0)
+      options.enabled = true;
+    else if(strcmp(argv[i], "--frames") == 0 && hasValue)
+      options.frames = std::max(1, atoi(argv[++i]));
+    else if(strcmp(argv[i], "--out") == 0 && hasValue)
+      options.output = argv[++i];
+    else if(strcmp(argv[i], "--width") == 0 && hasValue)
+      options.width = std::max(1, atoi(argv[++i]));
+    else if(strcmp(argv[i], "--height") == 0 && hasValue)
+      options.height = std::max(1, atoi(argv[++i]));
+    else if(strcmp(argv[i], "--csv") == 0 && hasValue)
+      options.csv = argv[++i];
+    else if(strcmp(argv[i], "--benchmark") == 0 && hasValue)
+      options.benchmarkFile = argv[++i];
+    else if(strcmp(argv[i], "--json") == 0 && hasValue)
+      options.json = argv[++i];
+  }
+
+  if(!options.benchmarkFile.empty())
+  {
+    if(!loadBenchmarkScenario(options.benchmarkFile, options.benchmark))
+      exit(1);
+    options.enabled = true;
+    options.frames  = options.benchmark.warmupFrames + options.benchmark.measuredFrames;
+    if(options.benchmark.width > 0)
+    {
+      options.width  = options.benchmark.width;
+      options.height = options.benchmark.height;
+    }
+  }
+  return options;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Rendering the frames one after the other, then saving the offscreen image
+//
+bool renderHeadless(nvvk::AppBaseVk&                                             app,
+                    nvvk::ResourceAllocator&                                     alloc,
+                    VkImage                                                      offscreenColor,
+                    const HeadlessOptions&                                       options,
+                    const std::function<void(const VkCommandBuffer&, uint32_t)>& renderFrame,
+                    GpuProfiler*                                                 profiler,
+                    const std::function<void(std::vector<float>&)>&              composite,
+                    const std::function<void(uint32_t)>&                         prepareFrame)
+{
+  using Clock = std::chrono::high_resolution_clock;
+
+  const bool               benchmarking = !options.benchmarkFile.empty();
+  const BenchmarkScenario& scenario     = options.benchmark;
+  BenchmarkResults         results;
+
+  // GPU time of the whole frame, for every sample
+  GpuProfiler frameTimer;
+  if(profiler)
+    profiler->m_keepHistory = !options.csv.empty();
+  if(benchmarking)
+  {
+    frameTimer.init(app.getDevice(), app.getPhysicalDevice(), app.getQueueFamily(), 1);
+    frameTimer.m_windowSize = scenario.measuredFrames;
+    if(profiler)
+      profiler->m_windowSize = scenario.measuredFrames;
+  }
+
+  nvvk::CommandPool cmdPool(app.getDevice(), app.getQueueFamily());
+  for(uint32_t frame = 0; frame < options.frames; frame++)
+  {
+    const bool measured = benchmarking && frame >= scenario.warmupFrames;
+    if(benchmarking)
+    {
+      if(frame == scenario.warmupFrames)
+      {
+        frameTimer.flush();
+        frameTimer.resetStats();
+        if(profiler)
+        {
+          profiler->flush();
+          profiler->resetStats();
+        }
+      }
+
+      BenchmarkScenario::CameraKey camera;
+      if(scenario.getCamera((measured ? frame - scenario.warmupFrames : 0) * scenario.frameTime, camera))
+        CameraManip.setLookat(camera.eye, camera.center, camera.up, true);
+    }
+
+    if(prepareFrame)
+      prepareFrame(frame);
+
+    const auto      start  = Clock::now();
+    VkCommandBuffer cmdBuf = cmdPool.createCommandBuffer();
+    if(benchmarking)
+    {
+      frameTimer.beginFrame(cmdBuf);
+      frameTimer.beginSection("Frame", cmdBuf);
+    }
+    renderFrame(cmdBuf, frame);
+    if(benchmarking)
+      frameTimer.endSection("Frame", cmdBuf);
+    const auto recorded = Clock::now();
+    cmdPool.submitAndWait(cmdBuf);
+
+    if(measured)
+    {
+      results.frameMs.push_back(std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+      results.recordMs.push_back(std::chrono::duration<float, std::milli>(recorded - start).count());
+    }
+  }
+
+  const VkExtent2D size = app.getSize();
+  if(benchmarking)
+  {
+    frameTimer.flush();
+    if(profiler)
+      profiler->flush();
+    for(GpuProfiler* timer : {&frameTimer, profiler})
+    {
+      if(timer == nullptr)
+        continue;
+      for(const auto& name : timer->getSectionNames())
+      {
+        GpuProfiler::Stats stats;
+        if(timer->getStats(name, stats))
+          results.gpu.push_back({name, stats.minMs, stats.meanMs, stats.p99Ms});
+      }
+    }
+    frameTimer.deinit();
+
+    results.hasMemory = getDeviceMemoryUsage(app.getPhysicalDevice(), results.memoryUsage, results.memoryBudget);
+    if(!writeBenchmarkJson(options.json, scenario, size, results))
+      return false;
+    LOGI("Benchmark: %s, results saved to %s\n", scenario.name.c_str(), options.json.c_str());
+  }
+
+  if(profiler)
+  {
+    profiler->flush();
+    if(!options.csv.empty() && !profiler->writeCsv(options.csv))
+      return false;
+  }
+
+  std::vector<float> rgba;
+  readbackImage(app, alloc, offscreenColor, size, rgba);
+  if(composite)
+    composite(rgba);
+  if(!saveExr(options.output, size.width, size.height, rgba.data()))
+  {
+    LOGE("Headless: failed to write %s\n", options.output.c_str());
+    return false;
+  }
+
+  LOGI("Headless: %u frame(s) rendered, image saved to %s\n", options.frames, options.output.c_str());
+  return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Copying the image to a host visible buffer and waiting for the result
+//
+void readbackImage(nvvk::AppBaseVk&         app,
+                   nvvk::ResourceAllocator& alloc,
+                   VkImage                  image,
+                   const VkExtent2D&        size,
+                   std::vector<float>&      pixels,
+                   uint32_t                 channels)
+{
+  const VkDeviceSize bufferSize = VkDeviceSize(size.width) * size.height * channels * sizeof(float);
+  nvvk::Buffer       staging    = alloc.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  nvvk::CommandPool cmdPool(app.getDevice(), app.getQueueFamily());
+  VkCommandBuffer   cmdBuf = cmdPool.createCommandBuffer();
+
+  // Rendering (storage image or color attachment) must be done before the copy
+  VkImageMemoryBarrier imageBarrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  imageBarrier.srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  imageBarrier.dstAccessMask       = VK_ACCESS_TRANSFER_READ_BIT;
+  imageBarrier.oldLayout           = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.image               = image;
+  imageBarrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &imageBarrier);
+
+  VkBufferImageCopy region{};
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent      = {size.width, size.height, 1};
+  vkCmdCopyImageToBuffer(cmdBuf, image, VK_IMAGE_LAYOUT_GENERAL, staging.buffer, 1, &region);
+
+  // Copy must be done before reading on the host
+  VkMemoryBarrier memBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  memBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memBarrier, 0,
+                       nullptr, 0, nullptr);
+  cmdPool.submitAndWait(cmdBuf);
+
+  pixels.resize(size_t(size.width) * size.height * channels);
+  memcpy(pixels.data(), alloc.map(staging), bufferSize);
+  alloc.unmap(staging);
+  alloc.destroy(staging);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Minimal OpenEXR writer: single part, scanlines, no compression, 32-bit float channels.
+// Each chunk is one scanline, channels are stored in alphabetical order (A, B, G, R).
+//
+bool saveExr(const std::string& filename, uint32_t width, uint32_t height, const float* rgba)
+{
+  std::ofstream out(filename, std::ios::binary);
+  if(!out)
+    return false;
+
+  auto writeI32 = [&](int32_t v) { out.write(reinterpret_cast<const char*>(&v), sizeof(v)); };
+  auto writeF32 = [&](float v) { out.write(reinterpret_cast<const char*>(&v), sizeof(v)); };
+  auto writeStr = [&](const char* s) { out.write(s, strlen(s) + 1); };
+  auto writeAttrib = [&](const char* name, const char* type, int32_t size) {
+    writeStr(name);
+    writeStr(type);
+    writeI32(size);
+  };
+
+  writeI32(20000630);  // Magic number
+  writeI32(2);         // Version 2, single part scanline
+
+  const char* channels[]  = {"A", "B", "G", "R"};
+  const int   rgbaIndex[] = {3, 2, 1, 0};
+  writeAttrib("channels", "chlist", 4 * (2 + 16) + 1);
+  for(const char* channel : channels)
+  {
+    writeStr(channel);
+    writeI32(2);  // FLOAT
+    writeI32(0);  // pLinear and reserved
+    writeI32(1);  // xSampling
+    writeI32(1);  // ySampling
+  }
+  out.put(0);
+
+  writeAttrib("compression", "compression", 1);
+  out.put(0);  // NO_COMPRESSION
+  for(const char* window : {"dataWindow", "displayWindow"})
+  {
+    writeAttrib(window, "box2i", 16);
+    writeI32(0);
+    writeI32(0);
+    writeI32(int32_t(width) - 1);
+    writeI32(int32_t(height) - 1);
+  }
+  writeAttrib("lineOrder", "lineOrder", 1);
+  out.put(0);  // INCREASING_Y
+  writeAttrib("pixelAspectRatio", "float", 4);
+  writeF32(1.f);
+  writeAttrib("screenWindowCenter", "v2f", 8);
+  writeF32(0.f);
+  writeF32(0.f);
+  writeAttrib("screenWindowWidth", "float", 4);
+  writeF32(1.f);
+  out.put(0);  // End of header
+
+  // Offset table: absolute position of each scanline chunk
+  const uint64_t lineSize   = uint64_t(width) * 4 * sizeof(float);
+  const uint64_t tableStart = static_cast<uint64_t>(out.tellp());
+  for(uint32_t y = 0; y < height; y++)
+  {
+    uint64_t offset = tableStart + uint64_t(height) * sizeof(uint64_t) + y * (2 * sizeof(int32_t) + lineSize);
+    out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+  }
+
+  std::vector<float> line(size_t(width) * 4);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    const float* row = rgba + size_t(y) * width * 4;
+    for(int c = 0; c < 4; c++)
+      for(uint32_t x = 0; x < width; x++)
+        line[c * width + x] = row[x * 4 + rgbaIndex[c]];
+
+    writeI32(int32_t(y));
+    writeI32(int32_t(lineSize));
+    out.write(reinterpret_cast<const char*>(line.data()), lineSize);
+  }
+
+  return out.good();
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// GLFW Callback functions
+//
+static void onErrorCallback(int error, const char* description)
+{
+  fprintf(stderr, "GLFW Error %d: %s\n", error, description);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Opening the window, which needs GLFW with Vulkan support
+//
+bool createSampleWindow(const HeadlessOptions& options, int width, int height, const char* title, GLFWwindow*& window)
+{
+  window = nullptr;
+  if(options.enabled)
+    return true;
+
+  glfwSetErrorCallback(onErrorCallback);
+  if(!glfwInit())
+  {
+    return false;
+  }
+  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  window = glfwCreateWindow(width, height, title, nullptr, nullptr);
+
+  if(!glfwVulkanSupported())
+  {
+    printf("GLFW: Vulkan Not Supported\n");
+    return false;
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Presenting to the window needs the surface and the swapchain extensions
+//
+void addSampleWindowExtensions(const HeadlessOptions& options, nvvk::ContextCreateInfo& contextInfo)
+{
+  if(options.enabled)
+    return;
+
+  uint32_t     count{0};
+  const char** reqExtensions = glfwGetRequiredInstanceExtensions(&count);
+  for(uint32_t ext_id = 0; ext_id < count; ext_id++)  // Adding required extensions (surface, win32, linux, ..)
+    contextInfo.addInstanceExtension(reqExtensions[ext_id]);
+  contextInfo.addDeviceExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);  // Enabling ability to present rendering
+}
+
+//--------------------------------------------------------------------------------------------------
+// The window need to be opened to get the surface on which to draw, and its queue
+//
+void setupSampleWindow(const HeadlessOptions& options, nvvk::Context& vkctx, nvvk::AppBaseVk& app, GLFWwindow* window, int width, int height)
+{
+  if(options.enabled)
+  {
+    // No swapchain, only the offscreen images with the requested size
+    app.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice, vkctx.m_queueGCT.familyIndex);
+    CameraManip.setWindowSize(options.width, options.height);
+    return;
+  }
+
+  const VkSurfaceKHR surface = app.getVkSurface(vkctx.m_instance, window);
+  vkctx.setGCTQueueWithPresent(surface);
+
+  app.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice, vkctx.m_queueGCT.familyIndex);
+  app.createSwapchain(surface, width, height);
+  app.createDepthBuffer();
+  app.createRenderPass();
+  app.createFrameBuffers();
+
+  // Setup Imgui
+  app.initGUI(0);  // Using sub-pass 0
+  app.setupGlfwCallbacks(window);
+  ImGui_ImplGlfw_InitForVulkan(window, true);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void destroySampleWindow(GLFWwindow* window)
+{
+  if(window == nullptr)
+    return;
+
+  glfwDestroyWindow(window);
+  glfwTerminate();
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include "benchmark.h"
+#include "gpu_profiler.h"
+#include "nvvk/appbase_vk.hpp"
+#include "nvvk/context_vk.hpp"
+#include "nvvk/resourceallocator_vk.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct GLFWwindow;
+
+//--------------------------------------------------------------------------------------------------
+// Headless rendering: no window, surface, swapchain, post-process nor UI.
+// The scene is rendered in the offscreen image for a number of frames, then the image is read back
+// and saved as an OpenEXR file. This allows to run the samples on machines without display, for
+// example with a software implementation of Vulkan such as lavapipe.
+//
+// Command line: --headless [--frames N] [--out file.exr] [--width W] [--height H] [--csv times.csv]
+//
+// Benchmark: --benchmark scenario.txt [--json results.json] implies --headless. The size, the number of
+// frames and the camera path come from the scenario (see benchmark.h), and the measures are written as JSON.
+//
+struct HeadlessOptions
+{
+  bool        enabled{false};
+  uint32_t    frames{1};
+  std::string output{"output.exr"};
+  uint32_t    width{0};
+  uint32_t    height{0};
+  std::string csv;  // GPU times of each frame, for the samples with a GpuProfiler
+
+  std::string       benchmarkFile;  // Empty when not benchmarking
+  BenchmarkScenario benchmark;
+  std::string       json{"benchmark.json"};
+};
+
+// The size defaults to the one of the sample window
+HeadlessOptions parseHeadlessOptions(int argc, char** argv, uint32_t defaultWidth, uint32_t defaultHeight);
+
+// Record and submit renderFrame `options.frames` times, each frame waiting for the previous one, then
+// save `offscreenColor` (VK_FORMAT_R32G32B32A32_SFLOAT in VK_IMAGE_LAYOUT_GENERAL) to `options.output`.
+// `composite` can modify the pixels before they are saved, ex. to apply what the post-process would do.
+// `prepareFrame` is called before the command buffer of each frame is recorded, when the device is idle.
+// The pass times of `profiler` are added to the benchmark results, and written to `options.csv`.
+bool renderHeadless(nvvk::AppBaseVk&                                             app,
+                    nvvk::ResourceAllocator&                                     alloc,
+                    VkImage                                                      offscreenColor,
+                    const HeadlessOptions&                                       options,
+                    const std::function<void(const VkCommandBuffer&, uint32_t)>& renderFrame,
+                    GpuProfiler*                                                 profiler     = nullptr,
+                    const std::function<void(std::vector<float>&)>&              composite    = {},
+                    const std::function<void(uint32_t)>&                         prepareFrame = {});
+
+// Copy a 32-bit float image with `channels` channels (4: RGBA32F, 2: RG32F, ..) in VK_IMAGE_LAYOUT_GENERAL to host memory
+void readbackImage(nvvk::AppBaseVk&         app,
+                   nvvk::ResourceAllocator& alloc,
+                   VkImage                  image,
+                   const VkExtent2D&        size,
+                   std::vector<float>&      pixels,
+                   uint32_t                 channels = 4);
+
+// Write RGBA float pixels (top row first) as an uncompressed scanline OpenEXR file
+bool saveExr(const std::string& filename, uint32_t width, uint32_t height, const float* rgba);
+
+
+//--------------------------------------------------------------------------------------------------
+// Window setup shared by the main() of the samples, skipped in headless mode
+//
+
+// GLFW window of the interactive mode, nullptr in headless mode. Returns false if GLFW or Vulkan is not supported.
+bool createSampleWindow(const HeadlessOptions& options, int width, int height, const char* title, GLFWwindow*& window);
+
+// Instance extensions of the window surface (win32, linux, ..) and the swapchain extension, none in headless mode
+void addSampleWindowExtensions(const HeadlessOptions& options, nvvk::ContextCreateInfo& contextInfo);
+
+// Setting up the application on the device, then the surface, swapchain, depth buffer, render pass, framebuffers,
+// ImGui and input callbacks of the window. Use setupSampleApp, which also sets the headless rendering size.
+void setupSampleWindow(const HeadlessOptions& options, nvvk::Context& vkctx, nvvk::AppBaseVk& app, GLFWwindow* window, int width, int height);
+
+// AppBaseVk only gets a size with the swapchain, the samples have setSize() for the headless mode
+template <typename App>
+void setupSampleApp(const HeadlessOptions& options, nvvk::Context& vkctx, App& app, GLFWwindow* window, int width, int height)
+{
+  setupSampleWindow(options, vkctx, app, window, width, height);
+  if(options.enabled)
+    app.setSize({options.width, options.height});
+}
+
+// Destroying the window and terminating GLFW, nothing in headless mode
+void destroySampleWindow(GLFWwindow* window);
@@ -22,8 +22,431 @@
 #include "obj_loader.h"
 #include "nvh/nvprint.hpp"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+// Increase when the layout of the cache or the content produced by the loader changes
+const uint32_t kObjCacheVersion = 3;
+const char     kObjCacheMagic[4] = {'O', 'B', 'J', 'C'};
+
+struct ObjCacheHeader
+{
+  char     magic[4];
+  uint32_t version;
+  uint32_t vertexSize;    // sizeof(VertexObj)
+  uint32_t materialSize;  // sizeof(MaterialObj)
+  uint64_t sourceSize;
+  int64_t  sourceTime;
+  uint64_t sourceHash;
+  uint64_t nbMaterialLibs;  // Stored after the header, see MaterialLibStamp
+  uint64_t nbVertices;
+  uint64_t nbIndices;
+  uint64_t nbMaterials;
+  uint64_t nbMatIndx;
+  uint64_t nbTextures;  // Stored last, each as uint32_t length followed by the characters
+};
+
+// Size and modification time of a .mtl file referenced by the source, followed by
+// the uint32_t length and the characters of its path
+struct MaterialLibStamp
+{
+  uint64_t size;  // kMissingFile if the file did not exist when the cache was written
+  int64_t  time;
+};
+
+const uint64_t kMissingFile = ~0ull;
+
+//--------------------------------------------------------------------------------------------------
+// Read-only memory mapping of a whole file
+//
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& filename)
+  {
+#ifdef _WIN32
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(m_file == INVALID_HANDLE_VALUE)
+      return;
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart == 0)
+      return;
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(m_mapping == nullptr)
+      return;
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    m_size = m_data ? static_cast<size_t>(fileSize.QuadPart) : 0;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+      return;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if(data != MAP_FAILED)
+      {
+        m_data = static_cast<const uint8_t*>(data);
+        m_size = static_cast<size_t>(st.st_size);
+      }
+    }
+    close(fd);  // The mapping stays valid after closing the descriptor
+#endif
+  }
+
+  ~MappedFile() { close(); }
+
+  // Releasing the mapping before the end of the scope, ex. to write the file
+  void close()
+  {
+#ifdef _WIN32
+    if(m_data)
+      UnmapViewOfFile(m_data);
+    if(m_mapping)
+      CloseHandle(m_mapping);
+    if(m_file != INVALID_HANDLE_VALUE)
+      CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file    = INVALID_HANDLE_VALUE;
+#else
+    if(m_data)
+      munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return m_data; }
+  size_t         size() const { return m_size; }
+
+private:
+  const uint8_t* m_data{nullptr};
+  size_t         m_size{0};
+#ifdef _WIN32
+  HANDLE m_file{INVALID_HANDLE_VALUE};
+  HANDLE m_mapping{nullptr};
+#endif
+};
+
+std::filesystem::path cacheDirectory(const std::string& directory)
+{
+  std::error_code ec;
+  return directory.empty() ? std::filesystem::temp_directory_path(ec) / "obj_cache" : std::filesystem::path(directory);
+}
+
+// One cache per source path: the name of the source and a hash of its absolute path
+std::string cacheFilename(const std::string& filename, const std::string& directory)
+{
+  std::error_code             ec;
+  const std::filesystem::path source   = std::filesystem::absolute(filename, ec);
+  const size_t                pathHash = std::hash<std::string>{}(source.generic_string());
+  return (cacheDirectory(directory) / (source.filename().string() + "-" + std::to_string(pathHash) + ".cache")).string();
+}
+
+// Storing a new source modification time in the header of an existing cache
+void writeCacheSourceTime(const std::string& cacheName, int64_t sourceTime)
+{
+  std::fstream file(cacheName, std::ios::binary | std::ios::in | std::ios::out);
+  if(!file)
+    return;
+  file.seekp(offsetof(ObjCacheHeader, sourceTime));
+  file.write(reinterpret_cast<const char*>(&sourceTime), sizeof(sourceTime));
+}
+
+// FNV-1a hash of the file content, 0 if the file cannot be read
+uint64_t hashFile(const std::string& filename)
+{
+  MappedFile file(filename);
+  uint64_t   hash = 14695981039346656037ull;
+  for(size_t i = 0; i < file.size(); i++)
+  {
+    hash ^= file.data()[i];
+    hash *= 1099511628211ull;
+  }
+  return file.data() ? hash : 0;
+}
+
+bool getSourceStamp(const std::string& filename, uint64_t& size, int64_t& time)
+{
+  std::error_code ec;
+  size = static_cast<uint64_t>(std::filesystem::file_size(filename, ec));
+  if(ec)
+    return false;
+  time = static_cast<int64_t>(std::filesystem::last_write_time(filename, ec).time_since_epoch().count());
+  return !ec;
+}
+
+// Paths of the material libraries named by the `mtllib` lines of the OBJ, relative to its directory
+// like tinyobj resolves them. All names of a line are returned, as tinyobj uses the first one found.
+std::vector<std::string> materialLibraries(const std::string& filename)
+{
+  std::vector<std::string>    libraries;
+  const std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+  std::ifstream               in(filename);
+  std::string                 line;
+  while(std::getline(in, line))
+  {
+    std::istringstream tokens(line);
+    std::string        token;
+    if(!(tokens >> token) || token != "mtllib")
+      continue;
+    while(tokens >> token)
+      libraries.push_back((directory / token).string());
+  }
+  return libraries;
+}
+
+// Calling fn(begin, end) on contiguous ranges splitting [0, count) over the hardware threads,
+// or once on the whole range when not parallel or when the work is too small to be split.
+template <typename F>
+void forEachRange(size_t count, bool parallel, F&& fn)
+{
+  const size_t kMinItemsPerThread = 16 * 1024;
+
+  size_t nbThreads = parallel ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+  nbThreads        = std::min(nbThreads, (count + kMinItemsPerThread - 1) / kMinItemsPerThread);
+  if(nbThreads <= 1)
+  {
+    fn(size_t(0), count);
+    return;
+  }
+
+  const size_t             rangeSize = (count + nbThreads - 1) / nbThreads;
+  std::vector<std::thread> threads;
+  threads.reserve(nbThreads);
+  for(size_t begin = 0; begin < count; begin += rangeSize)
+    threads.emplace_back([&fn, begin, end = std::min(begin + rangeSize, count)]() { fn(begin, end); });
+  for(auto& thread : threads)
+    thread.join();
+}
+
+}  // namespace
+
 
 void ObjLoader::loadModel(const std::string& filename)
+{
+  if(m_useCache && readCache(filename))
+    return;
+
+  parseModel(filename);
+
+  if(m_useCache)
+    writeCache(filename);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Filling all arrays from the cache, if it exists and was made from the current source file.
+// The source is considered unchanged if its size and modification time are the same,
+// or if only the time changed but the content hash is the same. The new time is then stored in the cache,
+// so that the next loads do not hash the source again.
+// The material libraries must also have kept their size and modification time, and not appeared or disappeared.
+//
+bool ObjLoader::readCache(const std::string& filename)
+{
+  uint64_t sourceSize;
+  int64_t  sourceTime;
+  if(!getSourceStamp(filename, sourceSize, sourceTime))
+    return false;
+
+  const std::string cacheName = cacheFilename(filename, m_cacheDirectory);
+  MappedFile        cache(cacheName);
+  if(cache.size() < sizeof(ObjCacheHeader))
+    return false;
+
+  ObjCacheHeader header;
+  memcpy(&header, cache.data(), sizeof(ObjCacheHeader));
+  if(memcmp(header.magic, kObjCacheMagic, sizeof(kObjCacheMagic)) != 0 || header.version != kObjCacheVersion
+     || header.vertexSize != sizeof(VertexObj) || header.materialSize != sizeof(MaterialObj) || header.sourceSize != sourceSize)
+    return false;
+
+  if(header.sourceTime != sourceTime && header.sourceHash != hashFile(filename))
+    return false;
+
+  const uint8_t* data = cache.data() + sizeof(ObjCacheHeader);
+  const uint8_t* end  = cache.data() + cache.size();
+
+  // The materials come from the .mtl files, which are not covered by the source stamp
+  for(uint64_t i = 0; i < header.nbMaterialLibs; i++)
+  {
+    MaterialLibStamp stamp;
+    uint32_t         length;
+    if(end - data < static_cast<ptrdiff_t>(sizeof(MaterialLibStamp) + sizeof(uint32_t)))
+      return false;
+    memcpy(&stamp, data, sizeof(MaterialLibStamp));
+    memcpy(&length, data + sizeof(MaterialLibStamp), sizeof(uint32_t));
+    data += sizeof(MaterialLibStamp) + sizeof(uint32_t);
+    if(end - data < static_cast<ptrdiff_t>(length))
+      return false;
+    const std::string library(reinterpret_cast<const char*>(data), length);
+    data += length;
+
+    uint64_t librarySize;
+    int64_t  libraryTime;
+    if(!getSourceStamp(library, librarySize, libraryTime))
+    {
+      if(stamp.size != kMissingFile)
+        return false;
+    }
+    else if(stamp.size != librarySize || stamp.time != libraryTime)
+      return false;
+  }
+
+  // All arrays except the textures have a fixed size
+  const uint64_t arraysSize = header.nbVertices * sizeof(VertexObj) + header.nbIndices * sizeof(uint32_t)
+                              + header.nbMaterials * sizeof(MaterialObj) + header.nbMatIndx * sizeof(int32_t);
+  if(static_cast<uint64_t>(end - data) < arraysSize)
+    return false;
+
+  auto readArray = [&data](auto& vec, uint64_t count) {
+    using T = typename std::remove_reference_t<decltype(vec)>::value_type;
+    vec.resize(count);
+    memcpy(vec.data(), data, count * sizeof(T));
+    data += count * sizeof(T);
+  };
+  readArray(m_vertices, header.nbVertices);
+  readArray(m_indices, header.nbIndices);
+  readArray(m_materials, header.nbMaterials);
+  readArray(m_matIndx, header.nbMatIndx);
+
+  m_textures.resize(header.nbTextures);
+  for(auto& texture : m_textures)
+  {
+    uint32_t length = 0;
+    bool     valid  = end - data >= static_cast<ptrdiff_t>(sizeof(uint32_t));
+    if(valid)
+    {
+      memcpy(&length, data, sizeof(uint32_t));
+      data += sizeof(uint32_t);
+      valid = end - data >= static_cast<ptrdiff_t>(length);
+    }
+
+    // Truncated cache, parse the source instead
+    if(!valid)
+    {
+      m_vertices.clear();
+      m_indices.clear();
+      m_materials.clear();
+      m_matIndx.clear();
+      m_textures.clear();
+      return false;
+    }
+
+    texture.assign(reinterpret_cast<const char*>(data), length);
+    data += length;
+  }
+
+  if(header.sourceTime != sourceTime)
+  {
+    cache.close();
+    writeCacheSourceTime(cacheName, sourceTime);
+  }
+
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Saving all arrays in the cache directory. Failing to write (ex. read-only directory) is not an error.
+//
+void ObjLoader::writeCache(const std::string& filename)
+{
+  ObjCacheHeader header{};
+  memcpy(header.magic, kObjCacheMagic, sizeof(kObjCacheMagic));
+  header.version      = kObjCacheVersion;
+  header.vertexSize   = sizeof(VertexObj);
+  header.materialSize = sizeof(MaterialObj);
+  if(!getSourceStamp(filename, header.sourceSize, header.sourceTime))
+    return;
+  const std::vector<std::string> libraries = materialLibraries(filename);
+
+  header.sourceHash     = hashFile(filename);
+  header.nbMaterialLibs = libraries.size();
+  header.nbVertices     = m_vertices.size();
+  header.nbIndices      = m_indices.size();
+  header.nbMaterials    = m_materials.size();
+  header.nbMatIndx      = m_matIndx.size();
+  header.nbTextures     = m_textures.size();
+
+  // Writing to a temporary file first, so a partially written cache is never read
+  std::error_code ec;
+  std::filesystem::create_directories(cacheDirectory(m_cacheDirectory), ec);
+
+  const std::string cacheName = cacheFilename(filename, m_cacheDirectory);
+  const std::string tempName  = cacheName + ".tmp";
+  {
+    std::ofstream out(tempName, std::ios::binary | std::ios::trunc);
+    if(!out)
+      return;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(const auto& library : libraries)
+    {
+      MaterialLibStamp stamp{kMissingFile, 0};
+      if(!getSourceStamp(library, stamp.size, stamp.time))
+        stamp = {kMissingFile, 0};
+      uint32_t length = static_cast<uint32_t>(library.size());
+      out.write(reinterpret_cast<const char*>(&stamp), sizeof(MaterialLibStamp));
+      out.write(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
+      out.write(library.data(), length);
+    }
+    out.write(reinterpret_cast<const char*>(m_vertices.data()), m_vertices.size() * sizeof(VertexObj));
+    out.write(reinterpret_cast<const char*>(m_indices.data()), m_indices.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(m_materials.data()), m_materials.size() * sizeof(MaterialObj));
+    out.write(reinterpret_cast<const char*>(m_matIndx.data()), m_matIndx.size() * sizeof(int32_t));
+    for(const auto& texture : m_textures)
+    {
+      uint32_t length = static_cast<uint32_t>(texture.size());
+      out.write(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
+      out.write(texture.data(), length);
+    }
+    if(!out)
+    {
+      out.close();
+      std::error_code ec;
+      std::filesystem::remove(tempName, ec);
+      return;
+    }
+  }
+
+  std::filesystem::rename(tempName, cacheName, ec);
+  if(ec)
+  {
+    LOGW("Cannot write OBJ cache: %s\n", cacheName.c_str());
+    std::filesystem::remove(tempName, ec);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Parsing the OBJ file with tinyobj
+//
+void ObjLoader::parseModel(const std::string& filename)
 {
   tinyobj::ObjReader reader;
   reader.ParseFromFile(filename);
@@ -60,16 +483,31 @@ void ObjLoader::loadModel(const std::string& filename)
   if(m_materials.empty())
     m_materials.emplace_back(MaterialObj());
 
-  const tinyobj::attrib_t& attrib = reader.GetAttrib();
+  const tinyobj::attrib_t&            attrib = reader.GetAttrib();
+  const std::vector<tinyobj::shape_t>& shapes = reader.GetShapes();
 
-  for(const auto& shape : reader.GetShapes())
+  // Prefix sum of the shape index counts: first corner of each shape in the output arrays
+  std::vector<size_t> shapeOffsets(shapes.size() + 1, 0);
+  for(size_t s = 0; s < shapes.size(); s++)
   {
-    m_vertices.reserve(shape.mesh.indices.size() + m_vertices.size());
-    m_indices.reserve(shape.mesh.indices.size() + m_indices.size());
-    m_matIndx.insert(m_matIndx.end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+    shapeOffsets[s + 1] = shapeOffsets[s] + shapes[s].mesh.indices.size();
+    m_matIndx.insert(m_matIndx.end(), shapes[s].mesh.material_ids.begin(), shapes[s].mesh.material_ids.end());
+  }
+
+  const size_t nbCorners = shapeOffsets.back();
+  m_vertices.resize(nbCorners);
+  m_indices.resize(nbCorners);
 
-    for(const auto& index : shape.mesh.indices)
+  // One vertex per face corner, each corner is independent of the others
+  forEachRange(nbCorners, m_parallelLoad, [&](size_t begin, size_t end) {
+    // Shape containing the first corner of the range
+    size_t s = std::upper_bound(shapeOffsets.begin(), shapeOffsets.end(), begin) - shapeOffsets.begin() - 1;
+    for(size_t c = begin; c < end; c++)
     {
+      while(c >= shapeOffsets[s + 1])
+        s++;
+      const tinyobj::index_t& index = shapes[s].mesh.indices[c - shapeOffsets[s]];
+
       VertexObj    vertex = {};
       const float* vp     = &attrib.vertices[3 * index.vertex_index];
       vertex.pos          = {*(vp + 0), *(vp + 1), *(vp + 2)};
@@ -92,10 +530,10 @@ void ObjLoader::loadModel(const std::string& filename)
         vertex.color    = {*(vc + 0), *(vc + 1), *(vc + 2)};
       }
 
-      m_vertices.push_back(vertex);
-      m_indices.push_back(static_cast<int>(m_indices.size()));
+      m_vertices[c] = vertex;
+      m_indices[c]  = static_cast<uint32_t>(c);
     }
-  }
+  });
 
   // Fixing material indices
   for(auto& mi : m_matIndx)
@@ -106,18 +544,80 @@ void ObjLoader::loadModel(const std::string& filename)
 
 
   // Compute normal when no normal were provided.
+  // Before welding, the three corners of a triangle are not shared with other triangles.
   if(attrib.normals.empty())
   {
-    for(size_t i = 0; i < m_indices.size(); i += 3)
+    forEachRange(m_indices.size() / 3, m_parallelLoad, [&](size_t begin, size_t end) {
+      for(size_t t = begin; t < end; t++)
+      {
+        VertexObj& v0 = m_vertices[m_indices[t * 3 + 0]];
+        VertexObj& v1 = m_vertices[m_indices[t * 3 + 1]];
+        VertexObj& v2 = m_vertices[m_indices[t * 3 + 2]];
+
+        nvmath::vec3f n = nvmath::normalize(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
+        v0.nrm          = n;
+        v1.nrm          = n;
+        v2.nrm          = n;
+      }
+    });
+  }
+
+  weldVertices();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Merging identical vertices (same position, normal, color and texture coordinates) and
+// replacing the per-corner indices by indices of the unique vertices.
+// Uses an open-addressing hash table with linear probing, storing the index of the unique vertex.
+//
+void ObjLoader::weldVertices()
+{
+  if(m_vertices.empty())
+    return;
+
+  static_assert(sizeof(VertexObj) % sizeof(uint32_t) == 0, "VertexObj is hashed as an array of 32 bit words");
+  constexpr size_t kNbWords = sizeof(VertexObj) / sizeof(uint32_t);
+
+  auto hashVertex = [](const VertexObj& v) {
+    uint32_t words[kNbWords];
+    memcpy(words, &v, sizeof(VertexObj));
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < kNbWords; i++)
     {
-      VertexObj& v0 = m_vertices[m_indices[i + 0]];
-      VertexObj& v1 = m_vertices[m_indices[i + 1]];
-      VertexObj& v2 = m_vertices[m_indices[i + 2]];
-
-      nvmath::vec3f n = nvmath::normalize(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
-      v0.nrm          = n;
-      v1.nrm          = n;
-      v2.nrm          = n;
+      hash ^= words[i];
+      hash *= 1099511628211ull;
     }
+    return hash ^ (hash >> 32);
+  };
+
+  // Table at least twice the number of vertices, to keep the probe sequences short
+  size_t tableSize = 1;
+  while(tableSize < m_vertices.size() * 2)
+    tableSize <<= 1;
+  const uint32_t        kEmpty = ~0u;
+  const size_t          mask   = tableSize - 1;
+  std::vector<uint32_t> table(tableSize, kEmpty);
+
+  // Remapping each original vertex to its unique vertex, compacting unique vertices at the front
+  std::vector<uint32_t> remap(m_vertices.size());
+  uint32_t              nbUnique = 0;
+  for(size_t i = 0; i < m_vertices.size(); i++)
+  {
+    const VertexObj& vertex = m_vertices[i];
+    size_t           slot   = hashVertex(vertex) & mask;
+    while(table[slot] != kEmpty && memcmp(&m_vertices[table[slot]], &vertex, sizeof(VertexObj)) != 0)
+      slot = (slot + 1) & mask;
+
+    if(table[slot] == kEmpty)
+    {
+      m_vertices[nbUnique] = vertex;  // nbUnique <= i, never overwrites a vertex not yet visited
+      table[slot]          = nbUnique++;
+    }
+    remap[i] = table[slot];
   }
+
+  m_vertices.resize(nbUnique);
+  m_vertices.shrink_to_fit();
+  for(auto& index : m_indices)
+    index = remap[index];
 }
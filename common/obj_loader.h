@@ -68,4 +68,19 @@ public:
   std::vector<MaterialObj> m_materials;
   std::vector<std::string> m_textures;
   std::vector<int32_t>     m_matIndx;
+
+  // Binary cache of the loaded arrays, one file per source path in m_cacheDirectory.
+  // Written after parsing, and memory-mapped instead of parsing the OBJ when the source and the .mtl files
+  // it references are unchanged.
+  bool        m_useCache{true};
+  std::string m_cacheDirectory;  // Empty: <temporary directory>/obj_cache, never in the media tree
+
+  // Building the vertices on all hardware threads. Disable to use the serial path (ex. determinism checks).
+  bool m_parallelLoad{true};
+
+private:
+  void parseModel(const std::string& filename);
+  void weldVertices();
+  bool readCache(const std::string& filename);
+  void writeCache(const std::string& filename);
 };
@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "raytrace_builder.h"
+#include "nvh/nvprint.hpp"
+#include "nvvk/buffers_vk.hpp"
+#include "nvvk/commands_vk.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+// Upper bound of minAccelerationStructureScratchOffsetAlignment required by the specification
+const VkDeviceSize kScratchAlignment = 256;
+
+VkDeviceSize alignUp(VkDeviceSize size, VkDeviceSize alignment)
+{
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// Building the BLAS in batches: each batch gets its own part of one shared scratch buffer of at most
+// m_blasScratchBudget bytes, and all the BLAS of a batch are built in a single call.
+// The batches are submitted without waiting for each other. With compaction, a batch is compacted
+// while the next one is being built, and the originals of a batch are released before the batch after
+// the next one is allocated, so at most two batches are in their non-compacted form.
+//
+void RaytracingBuilder::buildBlas(const std::vector<BlasInput>& input, VkBuildAccelerationStructureFlagsKHR flags)
+{
+  const uint32_t nbBlas  = static_cast<uint32_t>(input.size());
+  const bool     compact = (flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) != 0;
+
+  // Size of each acceleration structure and of its scratch memory
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR>     buildInfos(nbBlas);
+  std::vector<VkAccelerationStructureBuildSizesInfoKHR>        sizeInfos(nbBlas);
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRanges(nbBlas);
+  VkDeviceSize                                                 maxScratchSize{0};
+  VkDeviceSize                                                 totalScratchSize{0};
+  for(uint32_t i = 0; i < nbBlas; i++)
+  {
+    buildInfos[i]               = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+    buildInfos[i].type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    buildInfos[i].mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildInfos[i].flags         = input[i].flags | flags;
+    buildInfos[i].geometryCount = static_cast<uint32_t>(input[i].asGeometry.size());
+    buildInfos[i].pGeometries   = input[i].asGeometry.data();
+    buildRanges[i]              = input[i].asBuildOffsetInfo.data();
+
+    std::vector<uint32_t> maxPrimCount(input[i].asBuildOffsetInfo.size());
+    for(size_t g = 0; g < maxPrimCount.size(); g++)
+      maxPrimCount[g] = input[i].asBuildOffsetInfo[g].primitiveCount;
+
+    sizeInfos[i] = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfos[i],
+                                            maxPrimCount.data(), &sizeInfos[i]);
+    sizeInfos[i].buildScratchSize = alignUp(sizeInfos[i].buildScratchSize, kScratchAlignment);
+    maxScratchSize                = std::max(maxScratchSize, sizeInfos[i].buildScratchSize);
+    totalScratchSize += sizeInfos[i].buildScratchSize;
+  }
+
+  // The scratch buffer holds at least the largest build, even above the budget
+  const VkDeviceSize scratchSize = std::max(maxScratchSize, std::min(m_blasScratchBudget, totalScratchSize));
+  nvvk::Buffer       scratchBuffer =
+      m_alloc->createBuffer(scratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  VkDeviceAddress scratchAddress = nvvk::getBufferDeviceAddress(m_device, scratchBuffer.buffer);
+
+  // Consecutive BLAS sharing the scratch buffer, [batches[b], batches[b+1])
+  std::vector<uint32_t> batches{0};
+  VkDeviceSize          batchScratch{0};
+  for(uint32_t i = 0; i < nbBlas; i++)
+  {
+    if(batchScratch + sizeInfos[i].buildScratchSize > scratchSize)
+    {
+      batches.push_back(i);
+      batchScratch = 0;
+    }
+    buildInfos[i].scratchData.deviceAddress = scratchAddress + batchScratch;
+    batchScratch += sizeInfos[i].buildScratchSize;
+  }
+  batches.push_back(nbBlas);
+  const uint32_t nbBatches = static_cast<uint32_t>(batches.size() - 1);
+
+  // Query pool for the compacted sizes
+  VkQueryPool queryPool{VK_NULL_HANDLE};
+  if(compact)
+  {
+    VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    qpci.queryCount = nbBlas;
+    qpci.queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+    vkCreateQueryPool(m_device, &qpci, nullptr, &queryPool);
+  }
+
+  // Submitting without waiting, the fences tell when a batch is done
+  VkQueue queue{VK_NULL_HANDLE};
+  vkGetDeviceQueue(m_device, m_queueIndex, 0, &queue);
+  nvvk::CommandPool cmdPool(m_device, m_queueIndex);
+  auto              submit = [&](VkCommandBuffer cmdBuf) {
+    vkEndCommandBuffer(cmdBuf);
+    VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    VkFence           fence{VK_NULL_HANDLE};
+    vkCreateFence(m_device, &fenceInfo, nullptr, &fence);
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers    = &cmdBuf;
+    vkQueueSubmit(queue, 1, &submitInfo, fence);
+    return fence;
+  };
+  auto wait = [&](VkFence& fence) {
+    if(fence == VK_NULL_HANDLE)
+      return;
+    vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(m_device, fence, nullptr);
+    fence = VK_NULL_HANDLE;
+  };
+
+  m_blas.resize(nbBlas);
+  m_blasSizes.resize(nbBlas);
+  std::vector<VkDeviceSize>               buildSizes(nbBlas);
+  std::vector<VkAccelerationStructureKHR> handles(nbBlas);
+  std::vector<VkFence>                    buildFences(nbBatches, VK_NULL_HANDLE);
+
+  // Copy of the BLAS of a built batch into compacted acceleration structures
+  VkFence                     copyFence{VK_NULL_HANDLE};
+  std::vector<nvvk::AccelKHR> originals;  // Released once copyFence is signaled
+  auto                        releaseOriginals = [&]() {
+    wait(copyFence);
+    for(auto& original : originals)
+      m_alloc->destroy(original);
+    originals.clear();
+  };
+  auto                        compactBatch = [&](uint32_t b) {
+    const uint32_t first = batches[b];
+    const uint32_t count = batches[b + 1] - first;
+    wait(buildFences[b]);
+    std::vector<VkDeviceSize> compactSizes(count);
+    vkGetQueryPoolResults(m_device, queryPool, first, count, count * sizeof(VkDeviceSize), compactSizes.data(),
+                          sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+    // The previous copy must be done before releasing the BLAS it was reading
+    releaseOriginals();
+
+    VkCommandBuffer cmdBuf = cmdPool.createCommandBuffer();
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    for(uint32_t i = first; i < first + count; i++)
+    {
+      VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+      createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+      createInfo.size = compactSizes[i - first];
+      originals.push_back(m_blas[i]);
+      m_blas[i]      = m_alloc->createAcceleration(createInfo);
+      m_blasSizes[i] = createInfo.size;
+
+      VkCopyAccelerationStructureInfoKHR copyInfo{VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR};
+      copyInfo.src  = originals.back().accel;
+      copyInfo.dst  = m_blas[i].accel;
+      copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+      vkCmdCopyAccelerationStructureKHR(cmdBuf, &copyInfo);
+    }
+    copyFence = submit(cmdBuf);
+  };
+
+  for(uint32_t b = 0; b < nbBatches; b++)
+  {
+    const uint32_t first = batches[b];
+    const uint32_t count = batches[b + 1] - first;
+
+    // Batch b-2 must be freed before allocating this one, its compaction was submitted with batch b-1
+    releaseOriginals();
+
+    VkCommandBuffer cmdBuf = cmdPool.createCommandBuffer();
+
+    // The scratch buffer was used by the previous batch, and the built BLAS are read by the copies
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    for(uint32_t i = first; i < first + count; i++)
+    {
+      VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+      createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+      createInfo.size = sizeInfos[i].accelerationStructureSize;
+      m_blas[i]       = m_alloc->createAcceleration(createInfo);
+      buildSizes[i]   = createInfo.size;
+      m_blasSizes[i]  = createInfo.size;
+      handles[i]      = m_blas[i].accel;
+
+      buildInfos[i].dstAccelerationStructure = m_blas[i].accel;
+    }
+    vkCmdBuildAccelerationStructuresKHR(cmdBuf, count, &buildInfos[first], &buildRanges[first]);
+
+    if(compact)
+    {
+      // The compacted size can only be read once the BLAS are built
+      vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                           VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+      vkCmdResetQueryPool(cmdBuf, queryPool, first, count);
+      vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, count, &handles[first],
+                                                    VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, first);
+    }
+    buildFences[b] = submit(cmdBuf);
+
+    // Compacting the previous batch while this one is being built
+    if(compact && b > 0)
+      compactBatch(b - 1);
+  }
+  if(compact && nbBatches > 0)
+    compactBatch(nbBatches - 1);
+
+  for(auto& fence : buildFences)
+    wait(fence);
+  releaseOriginals();
+  if(compact)
+    vkDestroyQueryPool(m_device, queryPool, nullptr);
+
+  m_alloc->destroy(scratchBuffer);
+  m_alloc->finalizeAndReleaseStaging();
+
+  // Memory report
+  VkDeviceSize totalBuild{0}, totalFinal{0};
+  for(uint32_t i = 0; i < nbBlas; i++)
+  {
+    totalBuild += buildSizes[i];
+    totalFinal += m_blasSizes[i];
+    if(m_logBlasSizes && compact)
+      LOGI("  BLAS %u: %llu -> %llu bytes\n", i, (unsigned long long)buildSizes[i], (unsigned long long)m_blasSizes[i]);
+  }
+  LOGI("RT BLAS: %u built in %u batch(es), %.2f MB of scratch memory\n", nbBlas, nbBatches, scratchSize / (1024.0 * 1024.0));
+  if(compact)
+    LOGI("RT BLAS: compacted from %.2f MB to %.2f MB (%.1f%% smaller)\n", totalBuild / (1024.0 * 1024.0),
+         totalFinal / (1024.0 * 1024.0), totalBuild > 0 ? 100.0 * (totalBuild - totalFinal) / totalBuild : 0.0);
+  else
+    LOGI("RT BLAS: %.2f MB\n", totalBuild / (1024.0 * 1024.0));
+}
+
+void RaytracingBuilder::destroy()
+{
+  for(PersistentBuffer* buffer : {&m_blasUpdateScratch, &m_tlasUpdateScratch})
+  {
+    m_alloc->destroy(buffer->buffer);
+    buffer->size = 0;
+  }
+  for(InstanceCopy& copy : m_tlasInstanceCopies)
+  {
+    m_alloc->unmap(copy.buffer);
+    m_alloc->destroy(copy.buffer);
+  }
+  m_tlasInstanceCopies.clear();
+  m_tlasCurrentCopy = 0;
+  m_blasSizes.clear();
+  m_blasRefitCount.clear();
+  nvvk::RaytracingBuilderKHR::destroy();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Growing a buffer used by the recorded updates. The sizes do not change from frame to frame, so this
+// only waits for the device the first time a larger size is needed.
+//
+void RaytracingBuilder::ensureSize(PersistentBuffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+  if(size <= buffer.size)
+    return;
+  if(buffer.size > 0)
+  {
+    vkDeviceWaitIdle(m_device);  // Previous frames may still use the buffer
+    m_alloc->destroy(buffer.buffer);
+  }
+  buffer.buffer = m_alloc->createBuffer(size, usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+  buffer.size   = size;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Refit of all the BLAS in blasIndices with a single build call, recorded in cmdBuf.
+// inputs is the vector given to buildBlas: each BLAS is refitted from the geometry it was built with.
+// A BLAS refitted m_blasMaxRefits times is rebuilt in place instead, as refits only move the bounds
+// of the original hierarchy, which gets slower to trace as the geometry drifts away from it.
+//
+void RaytracingBuilder::cmdUpdateBlas(const VkCommandBuffer&               cmdBuf,
+                                      const std::vector<uint32_t>&         blasIndices,
+                                      const std::vector<BlasInput>&        inputs,
+                                      VkBuildAccelerationStructureFlagsKHR flags)
+{
+  if(blasIndices.empty())
+    return;
+  m_blasRefitCount.resize(m_blas.size(), 0);
+
+  const size_t                                                 nbBlas = blasIndices.size();
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR>     buildInfos(nbBlas);
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> pBuildOffsets(nbBlas);
+  std::vector<VkDeviceSize>                                    scratchOffsets(nbBlas);
+  VkDeviceSize                                                 scratchSize = 0;
+  for(size_t i = 0; i < nbBlas; i++)
+  {
+    const uint32_t   blasIdx = blasIndices[i];
+    const BlasInput& blas    = inputs[blasIdx];
+
+    VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = buildInfos[i];
+    buildInfo                          = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+    buildInfo.type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    buildInfo.mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+    buildInfo.flags                    = blas.flags | flags;
+    buildInfo.geometryCount            = static_cast<uint32_t>(blas.asGeometry.size());
+    buildInfo.pGeometries              = blas.asGeometry.data();
+    buildInfo.srcAccelerationStructure = m_blas[blasIdx].accel;
+    buildInfo.dstAccelerationStructure = m_blas[blasIdx].accel;
+    pBuildOffsets[i]                   = blas.asBuildOffsetInfo.data();
+
+    std::vector<uint32_t> maxPrimCount(blas.asBuildOffsetInfo.size());
+    for(size_t g = 0; g < maxPrimCount.size(); g++)
+      maxPrimCount[g] = blas.asBuildOffsetInfo[g].primitiveCount;
+    VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
+                                            maxPrimCount.data(), &sizeInfo);
+
+    // A compacted BLAS can be smaller than what a build needs, it can only be refitted
+    const bool rebuild = m_blasMaxRefits > 0 && m_blasRefitCount[blasIdx] >= m_blasMaxRefits
+                         && sizeInfo.accelerationStructureSize <= m_blasSizes[blasIdx];
+    if(rebuild)
+    {
+      buildInfo.mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+      buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+      m_blasRefitCount[blasIdx]          = 0;
+    }
+    else
+      m_blasRefitCount[blasIdx]++;
+
+    scratchOffsets[i] = scratchSize;
+    scratchSize += alignUp(rebuild ? sizeInfo.buildScratchSize : sizeInfo.updateScratchSize, kScratchAlignment);
+  }
+
+  // All the refits share one scratch arena, each one in its own range
+  ensureSize(m_blasUpdateScratch, scratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  const VkDeviceAddress scratchAddress = nvvk::getBufferDeviceAddress(m_device, m_blasUpdateScratch.buffer.buffer);
+  for(size_t i = 0; i < nbBlas; i++)
+    buildInfos[i].scratchData.deviceAddress = scratchAddress + scratchOffsets[i];
+
+  vkCmdBuildAccelerationStructuresKHR(cmdBuf, static_cast<uint32_t>(nbBlas), buildInfos.data(), pBuildOffsets.data());
+
+  // The TLAS update and the ray tracing use the refitted BLAS, the next refit reuses the scratch buffer
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Update of the TLAS with new instance transforms, recorded in cmdBuf.
+// The build reads the instances from one of m_tlasInstanceBufferCount persistently mapped buffers, used
+// in turn: the copy written by this frame is not read by the frames still in flight. Only the ranges that
+// changed since the copy was last used are written: the dirty ranges of this update, and the ones of the
+// updates that went to the other copies.
+//
+void RaytracingBuilder::cmdUpdateTlas(const VkCommandBuffer&                                 cmdBuf,
+                                      const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+                                      const std::vector<InstanceRange>&                      dirtyRanges,
+                                      VkBuildAccelerationStructureFlagsKHR                   flags)
+{
+  const uint32_t     countInstance = static_cast<uint32_t>(instances.size());
+  const VkDeviceSize instancesSize = countInstance * sizeof(VkAccelerationStructureInstanceKHR);
+
+  // First update: all the instances are written in each copy
+  if(m_tlasInstanceCopies.empty())
+  {
+    m_tlasInstanceCopies.resize(std::max(m_tlasInstanceBufferCount, 1u));
+    for(InstanceCopy& copy : m_tlasInstanceCopies)
+    {
+      copy.buffer = m_alloc->createBuffer(instancesSize,
+                                          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+                                              | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      copy.mapped  = static_cast<VkAccelerationStructureInstanceKHR*>(m_alloc->map(copy.buffer));
+      copy.pending = {{0, countInstance}};
+    }
+  }
+
+  InstanceCopy& current = m_tlasInstanceCopies[m_tlasCurrentCopy];
+  m_tlasCurrentCopy     = (m_tlasCurrentCopy + 1) % static_cast<uint32_t>(m_tlasInstanceCopies.size());
+  for(InstanceCopy& copy : m_tlasInstanceCopies)
+    copy.pending.insert(copy.pending.end(), dirtyRanges.begin(), dirtyRanges.end());
+
+  // Coherent memory: the writes are visible to the device when the command buffer is submitted
+  for(const InstanceRange& range : current.pending)
+  {
+    const uint32_t count = std::min(range.count, countInstance - std::min(range.first, countInstance));
+    memcpy(current.mapped + range.first, instances.data() + range.first, count * sizeof(VkAccelerationStructureInstanceKHR));
+  }
+  current.pending.clear();
+
+  cmdUpdateTlas(cmdBuf, nvvk::getBufferDeviceAddress(m_device, current.buffer.buffer), countInstance, flags);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Update of the TLAS from instances already in device memory, for example written by a compute shader.
+// The writes of the instances must be visible to the build stage.
+//
+void RaytracingBuilder::cmdUpdateTlas(const VkCommandBuffer&               cmdBuf,
+                                      VkDeviceAddress                      instancesAddress,
+                                      uint32_t                             countInstance,
+                                      VkBuildAccelerationStructureFlagsKHR flags)
+{
+  // The previous update and ray tracing must be done with the TLAS and the scratch buffer
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  VkAccelerationStructureGeometryInstancesDataKHR instancesVk{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR};
+  instancesVk.data.deviceAddress = instancesAddress;
+  VkAccelerationStructureGeometryKHR topASGeometry{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+  topASGeometry.geometryType       = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+  topASGeometry.geometry.instances = instancesVk;
+
+  VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+  buildInfo.type                     = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+  buildInfo.mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+  buildInfo.flags                    = flags;
+  buildInfo.geometryCount            = 1;
+  buildInfo.pGeometries              = &topASGeometry;
+  buildInfo.srcAccelerationStructure = m_tlas.accel;
+  buildInfo.dstAccelerationStructure = m_tlas.accel;
+
+  VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+  vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
+                                          &countInstance, &sizeInfo);
+  ensureSize(m_tlasUpdateScratch, sizeInfo.updateScratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  buildInfo.scratchData.deviceAddress = nvvk::getBufferDeviceAddress(m_device, m_tlasUpdateScratch.buffer.buffer);
+
+  VkAccelerationStructureBuildRangeInfoKHR        buildOffsetInfo{countInstance, 0, 0, 0};
+  const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+  vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pBuildOffsetInfo);
+
+  // The TLAS is used by the ray tracing of this frame
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include "nvvk/raytraceKHR_vk.hpp"
+
+#include <vector>
+
+
+//--------------------------------------------------------------------------------------------------
+// nvvk::RaytracingBuilderKHR, with a BLAS build reporting the memory used by each acceleration structure.
+//
+// Compaction is opt-in: when VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR is part of the
+// build flags, the compacted size of each BLAS is queried after the build, the BLAS is copied into an
+// acceleration structure of that size, and the original one is released.
+// This is worth it for static geometry, where it usually saves half of the memory, or more.
+//
+// The BLAS are built in batches sharing one scratch buffer of at most m_blasScratchBudget bytes (a single
+// BLAS needing more gets a larger buffer). The batches are queued without waiting for each other.
+// With compaction, at most two batches exist in their non-compacted form at the same time: before
+// allocating a batch, the compaction of the batch two steps before is waited for and its originals freed.
+//
+// cmdUpdateBlas and cmdUpdateTlas record refits in the frame command buffer instead of submitting and
+// waiting like updateBlas and buildTlas. Their scratch buffers are kept between frames, and the TLAS
+// instances are written directly in mapped buffers, only where they changed.
+//
+class RaytracingBuilder : public nvvk::RaytracingBuilderKHR
+{
+public:
+  void buildBlas(const std::vector<BlasInput>&      input,
+                 VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+
+  // Refit, in one build call, of the BLAS in blasIndices built with ALLOW_UPDATE from `inputs`.
+  // The new geometry must be visible to the build stage.
+  void cmdUpdateBlas(const VkCommandBuffer&               cmdBuf,
+                     const std::vector<uint32_t>&         blasIndices,
+                     const std::vector<BlasInput>&        inputs,
+                     VkBuildAccelerationStructureFlagsKHR flags);
+  struct InstanceRange
+  {
+    uint32_t first{0};
+    uint32_t count{0};
+  };
+  // Update of the TLAS built by buildTlas with ALLOW_UPDATE, always with the same number of instances.
+  // dirtyRanges are the instances modified since the previous update.
+  void cmdUpdateTlas(const VkCommandBuffer&                                 cmdBuf,
+                     const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+                     const std::vector<InstanceRange>&                      dirtyRanges,
+                     VkBuildAccelerationStructureFlagsKHR                   flags);
+  // Same, with the instances written on the device in a buffer with ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY usage
+  void cmdUpdateTlas(const VkCommandBuffer&               cmdBuf,
+                     VkDeviceAddress                      instancesAddress,
+                     uint32_t                             countInstance,
+                     VkBuildAccelerationStructureFlagsKHR flags);
+
+  void destroy();
+
+  // Size in bytes of a BLAS, after compaction
+  VkDeviceSize getBlasSize(uint32_t blasId) const { return m_blasSizes[blasId]; }
+
+  bool         m_logBlasSizes{true};              // Before and after compaction, for each BLAS
+  VkDeviceSize m_blasScratchBudget{256ull << 20};  // Scratch memory shared by the BLAS builds
+  uint32_t     m_blasMaxRefits{0};                // Refits before a BLAS is rebuilt, 0: never rebuilt
+  uint32_t     m_tlasInstanceBufferCount{2};      // Mapped instance buffers of cmdUpdateTlas, at least the frames in flight
+
+private:
+  struct PersistentBuffer
+  {
+    nvvk::Buffer buffer;
+    VkDeviceSize size{0};
+  };
+  void ensureSize(PersistentBuffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage);
+
+  struct InstanceCopy
+  {
+    nvvk::Buffer                        buffer;
+    VkAccelerationStructureInstanceKHR* mapped{nullptr};
+    std::vector<InstanceRange>          pending;  // Modified since this copy was last written
+  };
+
+  std::vector<VkDeviceSize> m_blasSizes;
+  std::vector<uint32_t>     m_blasRefitCount;  // Since the last build
+  PersistentBuffer          m_blasUpdateScratch;
+  PersistentBuffer          m_tlasUpdateScratch;
+  std::vector<InstanceCopy> m_tlasInstanceCopies;
+  uint32_t                  m_tlasCurrentCopy{0};
+};
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Core of the edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), shared by the denoisers of the samples.
+// The 5x5 B3-spline kernel is spread by stepWidth, and each tap is weighted down when its normal or position differs
+// from the center pixel. The filtered value (AO, color, ..) and its own weight are left to the compute shader.
+//
+// The G-Buffer holds the position in xyz and the compressed normal in w, and is 0 on the background.
+// PushConstantDenoise (host_device.h) must be declared before the include.
+
+#ifndef ATROUS_GLSL
+#define ATROUS_GLSL
+
+#include "unit_vector.glsl"
+
+const float atrousKernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+// Weight of the tap at offset (in [-2, 2]^2, before the step width) from the G-Buffer, 0 on the background
+float atrousGeometryWeight(ivec2 offset, vec3 position, vec3 normal, vec4 qGBuffer, PushConstantDenoise pc)
+{
+  if(qGBuffer == vec4(0))
+    return 0;
+
+  vec3  dn      = normal - DecompressUnitVec(floatBitsToUint(qGBuffer.w));
+  float dn2     = dot(dn, dn) / float(pc.stepWidth * pc.stepWidth);
+  float wNormal = min(exp(-dn2 / pc.normalPhi), 1.0);
+  vec3  dp      = position - qGBuffer.xyz;
+  float wPos    = min(exp(-dot(dp, dp) / pc.positionPhi), 1.0);
+  return atrousKernel[abs(offset.x)] * atrousKernel[abs(offset.y)] * wNormal * wPos;
+}
+
+// Weight of the tap from the squared difference between its value and the one of the center pixel
+float atrousValueWeight(float diff2, PushConstantDenoise pc)
+{
+  return min(exp(-diff2 / pc.colorPhi), 1.0);
+}
+
+#endif  // ATROUS_GLSL
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Compression of a unit vector, ex. a normal, in a uint: the vector is mapped to an octahedron, then
+// flattened to 2D with 16 bits per coordinate (see 'Octahedron Environment Maps' by Engelhardt & Dachsbacher).
+// Shared by the samples storing a normal in a G-Buffer.
+
+#ifndef UNIT_VECTOR_GLSL
+#define UNIT_VECTOR_GLSL
+
+#define C_Stack_Max 3.402823466e+38f
+
+// Non-finite vectors are stored as ~0u
+uint CompressUnitVec(vec3 nv)
+{
+  if((nv.x < C_Stack_Max) && !isinf(nv.x))
+  {
+    const float d = 32767.0f / (abs(nv.x) + abs(nv.y) + abs(nv.z));
+    int         x = int(roundEven(nv.x * d));
+    int         y = int(roundEven(nv.y * d));
+    if(nv.z < 0.0f)
+    {
+      const int maskx = x >> 31;
+      const int masky = y >> 31;
+      const int tmp   = 32767 + maskx + masky;
+      const int tmpx  = x;
+      x               = (tmp - (y ^ masky)) ^ maskx;
+      y               = (tmp - (tmpx ^ maskx)) ^ masky;
+    }
+    uint packed = (uint(y + 32767) << 16) | uint(x + 32767);
+    if(packed == ~0u)
+      return ~0x1u;
+    return packed;
+  }
+  else
+  {
+    return ~0u;
+  }
+}
+
+// Linearly maps a short in [-32767, 32767] to a float in [-1, 1]
+float ShortToFloatM11(const int v)
+{
+  return (v >= 0) ? (uintBitsToFloat(0x3F800000u | (uint(v) << 8)) - 1.0f) :
+                    (uintBitsToFloat((0x80000000u | 0x3F800000u) | (uint(-v) << 8)) + 1.0f);
+}
+
+// A non-finite vector gives vec3(C_Stack_Max)
+vec3 DecompressUnitVec(uint packed)
+{
+  if(packed != ~0u)
+  {
+    int       x     = int(packed & 0xFFFFu) - 32767;
+    int       y     = int(packed >> 16) - 32767;
+    const int maskx = x >> 31;
+    const int masky = y >> 31;
+    const int tmp0  = 32767 + maskx + masky;
+    const int ymask = y ^ masky;
+    const int tmp1  = tmp0 - (x ^ maskx);
+    const int z     = tmp1 - ymask;
+    float     zf;
+    if(z < 0)
+    {
+      x  = (tmp0 - ymask) ^ maskx;
+      y  = tmp1 ^ masky;
+      zf = uintBitsToFloat((0x80000000u | 0x3F800000u) | (uint(-z) << 8)) + 1.0f;
+    }
+    else
+    {
+      zf = uintBitsToFloat(0x3F800000u | (uint(z) << 8)) - 1.0f;
+    }
+    return normalize(vec3(ShortToFloatM11(x), ShortToFloatM11(y), zf));
+  }
+  else
+  {
+    return vec3(C_Stack_Max);
+  }
+}
+
+#endif  // UNIT_VECTOR_GLSL
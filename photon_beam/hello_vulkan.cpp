@@ -18,6 +18,7 @@
  */
 
 
+#include <cstddef>
 #include <sstream>
 
 
@@ -54,6 +55,23 @@ nvmath::vec3f getLightMotion(const float totalTime, const nvmath::vec3f& lightPo
   );
 }
 
+// Same hash as tea() in shaders/sampling.glsl, combining two values in a seed
+uint32_t hashSeed(uint32_t val0, uint32_t val1)
+{
+  uint32_t v0 = val0;
+  uint32_t v1 = val1;
+  uint32_t s0 = 0;
+
+  for(uint32_t n = 0; n < 16; n++)
+  {
+    s0 += 0x9e3779b9;
+    v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+    v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+  }
+
+  return v0;
+}
+
 
 
 void HelloVulkan::setDefaults()
@@ -65,12 +83,20 @@ void HelloVulkan::setDefaults()
   m_beamNearColor        = defaultBeamNearColor;
   m_beamUnitDistantColor = defaultBeamUnitDistantColor;
   m_beamRadius   = 0.6;
+  m_beamSplitMode     = eBeamSplitFixed;
+  m_beamSplitDistance = 10.0f;
+  m_accumulate         = false;
+  m_accumSampleDivisor = 4;
   m_photonRadius = 1.0;
   m_beamIntensity        = 15.0f;
   m_usePhotonMapping = true;
   m_usePhotonBeam    = true;
   m_hgAssymFactor    = 0.0;
   m_showDirectColor = false;
+  m_russianRoulette = true;
+  m_emissionGuiding = false;
+  m_emissionGuideUniform = 0.25f;
+  m_maxBounceDepth  = 16;
   m_airAlbedo            = 0.06;
 
   m_numBeamSamples = 1024;
@@ -107,6 +133,7 @@ void HelloVulkan::setup(const VkInstance& instance, const VkDevice& device, cons
   AppBaseVk::setup(instance, device, physicalDevice, queueFamily);
   m_alloc.init(instance, device, physicalDevice);
   m_debug.setup(m_device);
+  m_profiler.init(m_device, physicalDevice, queueFamily);
   m_offscreenDepthFormat = nvvk::findDepthFormat(physicalDevice);
   m_seedTime             = 0.0f;
   m_totalTime            = 0.0f;
@@ -367,26 +394,25 @@ void HelloVulkan::loadScene(const std::string& filename)
   }
   m_primInfo = m_alloc.createBuffer(cmdBuf, primLookup, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
 
-  m_beamBuffer = m_alloc.createBuffer(
-      cmdBuf, 
-      m_maxNumBeams * sizeof(PhotonBeam) + 4 * sizeof(uint), 
-      nullptr, 
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-  );
+  createBeamBuffers();
 
-  m_beamAsInfoBuffer = m_alloc.createBuffer(
-      cmdBuf, 
-      m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR), 
-      nullptr,
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+  // The counters of a frame are read when its slot comes back, after the frame has been waited for.
+  // Without swapchain (headless), each frame is waited for before the next one is recorded.
+  m_beamCountReadbackSlots = m_swapChain.getImageCount() + 1;
+  m_beamAsCountReadBuffer  = m_alloc.createBuffer(
+      m_beamCountReadbackSlots * 2 * sizeof(uint32_t), 
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
   );
+  m_beamCountReadback = static_cast<uint32_t*>(m_alloc.map(m_beamAsCountReadBuffer));
+  createEmissionGuide();
 
-  m_beamAsCountReadBuffer = m_alloc.createBuffer(
+  m_beamAsBuildRangeBuffer = m_alloc.createBuffer(
       cmdBuf, 
-      1 * sizeof(uint32_t), 
+      sizeof(ShaderVkAccelerationStructureBuildRangeInfoKHR), 
       nullptr,
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+          | VK_BUFFER_USAGE_TRANSFER_DST_BIT
   );
 
   SceneDesc sceneDesc;
@@ -413,9 +439,30 @@ void HelloVulkan::loadScene(const std::string& filename)
   NAME_VK(m_primInfo.buffer);
   NAME_VK(m_sceneDesc.buffer);
 
+  NAME_VK(m_beamAsCountReadBuffer.buffer);
+  NAME_VK(m_beamAsBuildRangeBuffer.buffer);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Buffers holding up to m_maxNumBeams beams and m_maxNumSubBeams sub-beam instances
+//
+void HelloVulkan::createBeamBuffers()
+{
+  // The counters at the beginning of the beam buffer are reset and copied with transfer commands
+  m_beamBuffer = m_alloc.createBuffer(
+      m_maxNumBeams * sizeof(PhotonBeam) + 4 * sizeof(uint), 
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+          | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+  );
+
+  m_beamAsInfoBuffer = m_alloc.createBuffer(
+      m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR), 
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+          | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+  );
+
   NAME_VK(m_beamBuffer.buffer);
   NAME_VK(m_beamAsInfoBuffer.buffer);
-  NAME_VK(m_beamAsCountReadBuffer.buffer);
 }
 
 
@@ -492,7 +539,12 @@ void HelloVulkan::destroyResources()
   m_alloc.destroy(m_pbTlas);
   m_alloc.destroy(m_beamTlasScratchBuffer);
   m_alloc.destroy(m_beamAsInfoBuffer);
+  m_alloc.unmap(m_beamAsCountReadBuffer);
   m_alloc.destroy(m_beamAsCountReadBuffer);
+  m_alloc.unmap(m_emissionReadBuffer);
+  m_alloc.destroy(m_emissionReadBuffer);
+  m_alloc.destroy(m_emissionGuideBuffer);
+  m_alloc.destroy(m_beamAsBuildRangeBuffer);
 
   vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
   vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
@@ -545,6 +597,7 @@ void HelloVulkan::destroyResources()
   vkDestroyDescriptorPool(m_device, m_rtDescPool, nullptr);
   vkDestroyDescriptorSetLayout(m_device, m_rtDescSetLayout, nullptr);
 
+  m_profiler.deinit();
   m_alloc.deinit();
 }
 
@@ -558,6 +611,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
   std::vector<VkDeviceSize> offsets = {0, 0, 0};
 
   m_debug.beginLabel(cmdBuf, "Rasterize");
+  m_profiler.beginSection("Rasterize", cmdBuf);
 
   // Dynamic Viewport
   setViewport(cmdBuf);
@@ -583,6 +637,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
     vkCmdDrawIndexed(cmdBuf, primitive.indexCount, 1, primitive.firstIndex, primitive.vertexOffset, 0);
   }
 
+  m_profiler.endSection("Rasterize", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
@@ -593,6 +648,7 @@ void HelloVulkan::onResize(int /*w*/, int /*h*/)
 {
   createOffscreenRender();
   updatePostDescriptorSet();
+  resetFrame();
   updateRtDescriptorSet();
 }
 
@@ -726,6 +782,7 @@ void HelloVulkan::updatePostDescriptorSet()
 void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
 {
   m_debug.beginLabel(cmdBuf, "Post");
+  m_profiler.beginSection("Post", cmdBuf);
 
   setViewport(cmdBuf);
 
@@ -735,6 +792,7 @@ void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
   vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &m_postDescSet, 0, nullptr);
   vkCmdDraw(cmdBuf, 3, 1, 0, 0);
 
+  m_profiler.endSection("Post", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
@@ -800,10 +858,15 @@ void HelloVulkan::createBeamASResources()
   m_pcRay.beamBlasAddress = m_pbBuilder.getBlasDeviceAddress(0);
   m_pcRay.photonBlasAddress = m_pbBuilder.getBlasDeviceAddress(1);
 
+  createBeamTlas();
+}
 
+//--------------------------------------------------------------------------------------------------
+// Beam TLAS and its scratch buffer, sized for m_maxNumSubBeams instances
+//
+void HelloVulkan::createBeamTlas()
+{
   VkBuildAccelerationStructureFlagsKHR flags  = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
-  bool                                 update = m_pbTlas.accel != nullptr;
-  bool                                 motion = false;
 
   VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, m_beamAsInfoBuffer.buffer};
   VkDeviceAddress instBufferAddr = vkGetBufferDeviceAddress(m_device, &bufferInfo);
@@ -899,7 +962,9 @@ void HelloVulkan::createBottomLevelAS()
     allBlas.push_back({geo});
   }
 
-  m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+  // The geometry is static: compacting the BLAS after the build
+  m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                                     | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -907,6 +972,13 @@ void HelloVulkan::createBottomLevelAS()
 //
 void HelloVulkan::createTopLevelAS()
 {
+  // The custom index is stored in the 16 low bits of PhotonBeam::mediaAndInstance, 0xFFFF meaning no hit
+  if(m_gltfScene.m_primMeshes.size() >= 0xFFFF)
+  {
+    LOGE("Photon beams support up to 65535 primitive meshes, the scene has %zu\n", m_gltfScene.m_primMeshes.size());
+    assert(!"Too many primitive meshes for PhotonBeam::mediaAndInstance");
+  }
+
   std::vector<VkAccelerationStructureInstanceKHR> tlas;
   tlas.reserve(m_gltfScene.m_nodes.size());
   for(auto& node : m_gltfScene.m_nodes)
@@ -936,6 +1008,10 @@ void HelloVulkan::createPbDescriptorSet()
                                 VK_SHADER_STAGE_RAYGEN_BIT_KHR);  // photon beam data
   m_pbDescSetLayoutBind.addBinding(PbBindings::ePbPhotonBeamAs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                                    VK_SHADER_STAGE_RAYGEN_BIT_KHR);  // photon beam data
+  m_pbDescSetLayoutBind.addBinding(PbBindings::ePbPhotonBeamAsBuildRange, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                   VK_SHADER_STAGE_RAYGEN_BIT_KHR);  // beam TLAS build range
+  m_pbDescSetLayoutBind.addBinding(PbBindings::ePbEmissionGuide, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                   VK_SHADER_STAGE_RAYGEN_BIT_KHR);  // sampling of the light directions
 
   m_pbDescPool      = m_pbDescSetLayoutBind.createPool(m_device);
   m_pbDescSetLayout = m_pbDescSetLayoutBind.createLayout(m_device);
@@ -954,12 +1030,16 @@ void HelloVulkan::createPbDescriptorSet()
   VkDescriptorBufferInfo primitiveInfoDesc{m_primInfo.buffer, 0, VK_WHOLE_SIZE};
   VkDescriptorBufferInfo beamInfo{m_beamBuffer.buffer, 0, VK_WHOLE_SIZE};
   VkDescriptorBufferInfo beamAsInfo{m_beamAsInfoBuffer.buffer, 0, VK_WHOLE_SIZE};
+  VkDescriptorBufferInfo beamAsBuildRangeInfo{m_beamAsBuildRangeBuffer.buffer, 0, VK_WHOLE_SIZE};
+  VkDescriptorBufferInfo emissionGuideInfo{m_emissionGuideBuffer.buffer, 0, VK_WHOLE_SIZE};
 
   std::vector<VkWriteDescriptorSet> writes;
   writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbTlas, &descASInfo));
   writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbPrimLookup, &primitiveInfoDesc));
   writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbPhotonBeam, &beamInfo));
   writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbPhotonBeamAs, &beamAsInfo));
+  writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbPhotonBeamAsBuildRange, &beamAsBuildRangeInfo));
+  writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbEmissionGuide, &emissionGuideInfo));
   vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
@@ -1064,15 +1144,18 @@ void HelloVulkan::createPbPipeline()
 void HelloVulkan::setBeamPushConstants(const nvmath::vec4f& clearColor)
 {
   // Initializing push constant values
-  m_pcRay.clearColor       = clearColor;
+  m_pcRay.clearColor       = vec3(clearColor);
   m_pcRay.beamRadius       = m_beamRadius;
   m_pcRay.photonRadius     = m_photonRadius;
   m_pcRay.maxNumBeams      = m_maxNumBeams;
   m_pcRay.maxNumSubBeams   = m_maxNumSubBeams;
   m_pcRay.airHGAssymFactor = m_hgAssymFactor;
-  m_pcRay.numBeamSources   = m_numBeamSamples;
-  m_pcRay.numPhotonSources = m_numPhotonSamples;
-  m_pcRay.showDirectColor  = m_showDirectColor ? 1 : 0;
+  m_pcRay.numBeamSources   = getFrameBeamSamples();
+  m_pcRay.numPhotonSources = getFramePhotonSamples();
+  m_pcRay.flags            = (m_showDirectColor ? eRayShowDirectColor : 0) | (m_russianRoulette ? eRayRussianRoulette : 0)
+                      | (m_emissionGuiding ? eRayEmissionGuiding : 0) | (MIN(m_maxBounceDepth, 255u) << eRayMaxBounceShift);
+  m_pcRay.beamSplitMode     = m_beamSplitMode;
+  m_pcRay.beamSplitDistance = m_beamSplitDistance;
 
   // Bellow sets scatter and extinct cofficients and source light power, 
   // given the distance from the light source, 
@@ -1204,9 +1287,12 @@ void HelloVulkan::updateRtDescriptorSetBeamTlas()
 void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBuffer& cmdBuf)
 {
     setBeamPushConstants(clearColor);
+    // Before the beam trace, which uses the seed of the accumulated frame
+    updateFrame();
 
 
     m_debug.beginLabel(cmdBuf, "Beam trace");
+    m_profiler.beginSection("Beam trace", cmdBuf);
 
     std::vector<VkDescriptorSet> descSets{m_pbDescSet, m_descSet};
 
@@ -1214,25 +1300,38 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
     vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_pbPipelineLayout, 0,
                             (uint32_t)descSets.size(), descSets.data(), 0, nullptr);
 
-    m_pcRay.numBeamSources   = m_usePhotonBeam ? m_numBeamSamples : 0;
-    m_pcRay.numPhotonSources = m_usePhotonMapping ? m_numPhotonSamples : 0;
+    m_pcRay.numBeamSources   = m_usePhotonBeam ? getFrameBeamSamples() : 0;
+    m_pcRay.numPhotonSources = m_usePhotonMapping ? getFramePhotonSamples() : 0;
     vkCmdPushConstants(cmdBuf, m_pbPipelineLayout,
                        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
                        0, sizeof(PushConstantRay), &m_pcRay);
 
 
     vkCmdFillBuffer(cmdBuf, m_beamBuffer.buffer, 0, sizeof(uint) * 2, 0);
-    vkCmdFillBuffer(
-        cmdBuf, 
-        m_beamAsInfoBuffer.buffer, 
-        0,
-        m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR), 
-        0
-    );
+
+    // With the indirect build, only the instances written by the beam trace of this frame are used for the build,
+    // so the stale instances of the previous frame do not have to be cleared.
+    // Otherwise the whole instance buffer is built, and unused instances must be zero(inactive) instances.
+    VkBuffer     resetBuffer = m_useIndirectBeamBuild ? m_beamAsBuildRangeBuffer.buffer : m_beamAsInfoBuffer.buffer;
+    VkDeviceSize resetSize   = m_useIndirectBeamBuild ? sizeof(ShaderVkAccelerationStructureBuildRangeInfoKHR) :
+                                                        m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR);
+    // The TLAS build of the previous frame may still read the build range (or the instances) being reset
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(cmdBuf, resetBuffer, 0, resetSize, 0);
+
+    // The emission guide of the previous frame may still be read by its beam trace and its histogram copy
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(cmdBuf, m_emissionGuideBuffer.buffer, offsetof(EmissionGuide, histogram),
+                    sizeof(EmissionGuide::histogram), 0);
+    if(m_emissionGuiding)
+        vkCmdUpdateBuffer(cmdBuf, m_emissionGuideBuffer.buffer, 0, sizeof(EmissionGuide::cdf), m_emissionCdf.data());
 
     // barrier for making ray traycing to proceed after the counters are reset to 0
 
-    VkBufferMemoryBarrier beamDataBarriers[2] = {
+    VkBufferMemoryBarrier beamDataBarriers[3] = {
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER},
       {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER},
       {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER}
     };
@@ -1244,10 +1343,16 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
     beamDataBarriers[0].size                   = sizeof(uint) * 2;  // for sub beamphoton counter and beam counter
 
     beamDataBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    beamDataBarriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    beamDataBarriers[1].buffer        = m_beamAsInfoBuffer.buffer;
+    beamDataBarriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    beamDataBarriers[1].buffer        = resetBuffer;
     beamDataBarriers[1].offset        = 0;
-    beamDataBarriers[1].size = m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR);  // for sub beamphoton counter and beam counter
+    beamDataBarriers[1].size          = resetSize;
+
+    beamDataBarriers[2].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    beamDataBarriers[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    beamDataBarriers[2].buffer        = m_emissionGuideBuffer.buffer;
+    beamDataBarriers[2].offset        = 0;
+    beamDataBarriers[2].size          = VK_WHOLE_SIZE;
 
     vkCmdPipelineBarrier(
         cmdBuf, 
@@ -1255,7 +1360,7 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
         0,
         0, nullptr, 
-        2, beamDataBarriers, 
+        3, beamDataBarriers, 
         0, nullptr
     );
 
@@ -1264,17 +1369,28 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
         cmdBuf, 
         &regions[0], &regions[1], &regions[2], &regions[3],
          // It seems 4096 is the maximum allowed value for the next 3 parameters, larger value does not lauhcn ray tracing
-         4, 4, MAX(m_numPhotonSamples, m_numBeamSamples) / 16
+         4, 4, (MAX(getFramePhotonSamples(), getFrameBeamSamples()) + 15) / 16
     );
+    m_profiler.endSection("Beam trace", cmdBuf);
 
 
-    VkBufferMemoryBarrier subBeamDataBarrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    VkBufferMemoryBarrier subBeamDataBarriers[2] = {
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER},
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER}
+    };
 
-    subBeamDataBarrier.srcAccessMask  = VK_ACCESS_SHADER_WRITE_BIT;
-    subBeamDataBarrier.dstAccessMask  = VK_ACCESS_MEMORY_READ_BIT;
-    subBeamDataBarrier.buffer         = m_beamAsInfoBuffer.buffer;
-    subBeamDataBarrier.offset         = 0;
-    subBeamDataBarrier.size = m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR);  // for sub beamphoton counter and beam counter
+    subBeamDataBarriers[0].srcAccessMask  = VK_ACCESS_SHADER_WRITE_BIT;
+    subBeamDataBarriers[0].dstAccessMask  = VK_ACCESS_MEMORY_READ_BIT;
+    subBeamDataBarriers[0].buffer         = m_beamAsInfoBuffer.buffer;
+    subBeamDataBarriers[0].offset         = 0;
+    subBeamDataBarriers[0].size = m_maxNumSubBeams * sizeof(ShaderVkAccelerationStructureInstanceKHR);  // for sub beamphoton counter and beam counter
+
+    // the build range is read as indirect build parameter
+    subBeamDataBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    subBeamDataBarriers[1].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    subBeamDataBarriers[1].buffer        = m_beamAsBuildRangeBuffer.buffer;
+    subBeamDataBarriers[1].offset        = 0;
+    subBeamDataBarriers[1].size          = sizeof(ShaderVkAccelerationStructureBuildRangeInfoKHR);
   
     vkCmdPipelineBarrier(
         cmdBuf, 
@@ -1283,8 +1399,8 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
         0, 
         0, 
         nullptr, 
-        1, 
-        &subBeamDataBarrier, 
+        m_useIndirectBeamBuild ? 2 : 1, 
+        subBeamDataBarriers, 
         0, 
         nullptr
     );
@@ -1359,12 +1475,27 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
     buildInfo.dstAccelerationStructure  = m_pbTlas.accel;
     buildInfo.scratchData.deviceAddress = scratchAddress;
 
-    // Build Offsets info: n instances
-    VkAccelerationStructureBuildRangeInfoKHR        buildOffsetInfo{m_maxNumSubBeams, 0, 0, 0};
-    const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+    m_profiler.beginSection("Beam TLAS", cmdBuf);
+    if(m_useIndirectBeamBuild)
+    {
+        // Build the TLAS with the number of sub-beams written by photonbeam.rgen.
+        // m_maxNumSubBeams is only the upper bound used for the sizes above.
+        VkDeviceAddress buildRangeAddress = nvvk::getBufferDeviceAddress(m_device, m_beamAsBuildRangeBuffer.buffer);
+        const uint32_t  buildRangeStride  = sizeof(VkAccelerationStructureBuildRangeInfoKHR);
+        const uint32_t* pMaxPrimitiveCounts = &m_maxNumSubBeams;
 
-    // Build the TLAS
-    vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pBuildOffsetInfo);
+        vkCmdBuildAccelerationStructuresIndirectKHR(cmdBuf, 1, &buildInfo, &buildRangeAddress, &buildRangeStride, &pMaxPrimitiveCounts);
+    }
+    else
+    {
+        // Build Offsets info: n instances
+        VkAccelerationStructureBuildRangeInfoKHR        buildOffsetInfo{m_maxNumSubBeams, 0, 0, 0};
+        const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+
+        // Build the TLAS
+        vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pBuildOffsetInfo);
+    }
+    m_profiler.endSection("Beam TLAS", cmdBuf);
     
     m_debug.endLabel(cmdBuf);
 
@@ -1386,6 +1517,212 @@ void HelloVulkan::buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBu
         nullptr
     );
 
+    cmdReadBeamCounts(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Copies the beam counters and the emission histogram of this frame in their readback slots.
+// The slots are read by updateBeamCapacity and updateEmissionGuide when they come back,
+// m_beamCountReadbackSlots frames later.
+//
+void HelloVulkan::cmdReadBeamCounts(const VkCommandBuffer& cmdBuf)
+{
+    const uint32_t slot = m_beamCountFrame % m_beamCountReadbackSlots;
+    m_beamCountFrame++;
+
+    VkBufferMemoryBarrier counterBarriers[2] = {
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER},
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER}
+    };
+    counterBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    counterBarriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    counterBarriers[0].buffer        = m_beamBuffer.buffer;
+    counterBarriers[0].offset        = 0;
+    counterBarriers[0].size          = sizeof(uint) * 2;  // for sub beamphoton counter and beam counter
+    counterBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    counterBarriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    counterBarriers[1].buffer        = m_emissionGuideBuffer.buffer;
+    counterBarriers[1].offset        = offsetof(EmissionGuide, histogram);
+    counterBarriers[1].size          = sizeof(EmissionGuide::histogram);
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+                         nullptr, 2, counterBarriers, 0, nullptr);
+
+    VkBufferCopy region{0, slot * 2 * sizeof(uint32_t), 2 * sizeof(uint32_t)};
+    vkCmdCopyBuffer(cmdBuf, m_beamBuffer.buffer, m_beamAsCountReadBuffer.buffer, 1, &region);
+    VkBufferCopy histogramRegion{offsetof(EmissionGuide, histogram), slot * sizeof(EmissionGuide::histogram),
+                                 sizeof(EmissionGuide::histogram)};
+    vkCmdCopyBuffer(cmdBuf, m_emissionGuideBuffer.buffer, m_emissionReadBuffer.buffer, 1, &histogramRegion);
+
+    VkBufferMemoryBarrier hostBarriers[2] = {
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER},
+      {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER}
+    };
+    hostBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarriers[0].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarriers[0].buffer        = m_beamAsCountReadBuffer.buffer;
+    hostBarriers[0].offset        = region.dstOffset;
+    hostBarriers[0].size          = region.size;
+    hostBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarriers[1].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarriers[1].buffer        = m_emissionReadBuffer.buffer;
+    hostBarriers[1].offset        = histogramRegion.dstOffset;
+    hostBarriers[1].size          = histogramRegion.size;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 2,
+                         hostBarriers, 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Guide of the light directions: starts with uniform sampling until histograms are read back
+//
+void HelloVulkan::createEmissionGuide()
+{
+  m_emissionGuideBuffer = m_alloc.createBuffer(sizeof(EmissionGuide), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                                                          | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                                                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  m_emissionReadBuffer  = m_alloc.createBuffer(m_beamCountReadbackSlots * sizeof(EmissionGuide::histogram),
+                                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_emissionReadback = static_cast<uint32_t*>(m_alloc.map(m_emissionReadBuffer));
+
+  m_emissionAverage.assign(EMISSION_GUIDE_CELLS, 0.0f);
+  m_emissionCdf.resize(EMISSION_GUIDE_CELLS);
+  for(uint32_t i = 0; i < EMISSION_GUIDE_CELLS; i++)
+    m_emissionCdf[i] = float(i + 1) / float(EMISSION_GUIDE_CELLS);
+
+  NAME_VK(m_emissionGuideBuffer.buffer);
+  NAME_VK(m_emissionReadBuffer.buffer);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Must be called between frames, before the command buffer of the beam trace is recorded: the beam buffers
+// may be reallocated, which waits for the device and rewrites the descriptor sets referencing them.
+//
+void HelloVulkan::prepareBeamTrace()
+{
+    updateBeamCapacity();
+    updateEmissionGuide();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reads the emission histogram of the oldest frame and rebuilds the sampling probabilities.
+// The paths reaching the scene from a cell are divided by the probability the cell had, to get the
+// fraction of its directions reaching the scene, and the cells are then sampled proportionally to it.
+//
+void HelloVulkan::updateEmissionGuide()
+{
+    if(!m_emissionGuiding || m_beamCountFrame < m_beamCountReadbackSlots)
+        return;
+
+    const uint32_t* histogram = m_emissionReadback + (m_beamCountFrame % m_beamCountReadbackSlots) * EMISSION_GUIDE_CELLS;
+    const float     blend     = 0.1f;  // Averaging about the last ten frames
+
+    float total = 0.0f;
+    for(uint32_t i = 0; i < EMISSION_GUIDE_CELLS; i++)
+    {
+        // The probability of the cell may have changed since this frame, the average smooths the difference
+        float probability    = m_emissionCdf[i] - (i > 0 ? m_emissionCdf[i - 1] : 0.0f);
+        float reached        = float(histogram[i]) / MAX(probability * EMISSION_GUIDE_CELLS, 1e-6f);
+        m_emissionAverage[i] = m_emissionAverage[i] * (1.0f - blend) + reached * blend;
+        total += m_emissionAverage[i];
+    }
+
+    const float uniform = MIN(MAX(m_emissionGuideUniform, 0.0f), 1.0f);
+    float       sum     = 0.0f;
+    for(uint32_t i = 0; i < EMISSION_GUIDE_CELLS; i++)
+    {
+        float guided = total > 0.0f ? m_emissionAverage[i] / total : 1.0f / EMISSION_GUIDE_CELLS;
+        sum += uniform / EMISSION_GUIDE_CELLS + (1.0f - uniform) * guided;
+        m_emissionCdf[i] = sum;
+    }
+    m_emissionCdf.back() = 1.0f;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reads the counters of the oldest frame, which is complete, and adapts the buffer capacities to them.
+// The buffers grow as soon as beams are dropped, and shrink only after being used below a quarter for a
+// while, so that the reallocation, which waits for the device, does not happen back and forth.
+//
+void HelloVulkan::updateBeamCapacity()
+{
+    if(m_beamCountFrame < m_beamCountReadbackSlots)
+        return;
+
+    const uint32_t slot = m_beamCountFrame % m_beamCountReadbackSlots;
+    m_subBeamCount      = m_beamCountReadback[slot * 2 + 0];
+    m_beamCount         = m_beamCountReadback[slot * 2 + 1];
+
+    if(!m_autoBeamCapacity)
+    {
+        m_beamShrinkFrames = 0;
+        return;
+    }
+
+    // The beam index is stored in the 24 bits of the instance custom index, which is also the usual
+    // maximum number of TLAS instances
+    const uint32_t maxCapacity = 1u << 24;
+    const uint32_t minCapacity = 4096;
+    const uint32_t shrinkDelay = 120;  // Readbacks
+
+    uint32_t numBeams    = m_maxNumBeams;
+    uint32_t numSubBeams = m_maxNumSubBeams;
+    bool     grow        = m_beamCount > m_maxNumBeams || m_subBeamCount > m_maxNumSubBeams;
+    if(grow)
+    {
+        // 50% above the demand, the dropped beams did not add their next bounces to the counters
+        if(m_beamCount > m_maxNumBeams)
+            numBeams = MIN(maxCapacity, m_beamCount + m_beamCount / 2);
+        if(m_subBeamCount > m_maxNumSubBeams)
+            numSubBeams = MIN(maxCapacity, m_subBeamCount + m_subBeamCount / 2);
+        m_beamShrinkFrames = 0;
+    }
+    else if(m_beamCount < m_maxNumBeams / 4 || m_subBeamCount < m_maxNumSubBeams / 4)
+    {
+        if(++m_beamShrinkFrames >= shrinkDelay)
+        {
+            if(m_beamCount < m_maxNumBeams / 4)
+                numBeams = MAX(minCapacity, m_beamCount * 2);
+            if(m_subBeamCount < m_maxNumSubBeams / 4)
+                numSubBeams = MAX(minCapacity, m_subBeamCount * 2);
+            m_beamShrinkFrames = 0;
+        }
+    }
+    else
+    {
+        m_beamShrinkFrames = 0;
+    }
+
+    if(numBeams != m_maxNumBeams || numSubBeams != m_maxNumSubBeams)
+        resizeBeamBuffers(numBeams, numSubBeams);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reallocates the beam buffers and the beam TLAS, and updates the descriptors referencing them
+//
+void HelloVulkan::resizeBeamBuffers(uint32_t maxNumBeams, uint32_t maxNumSubBeams)
+{
+    LOGI("Beam capacity: %u beams, %u sub-beams\n", maxNumBeams, maxNumSubBeams);
+
+    // Still used by the frames in flight
+    vkDeviceWaitIdle(m_device);
+    m_alloc.destroy(m_pbTlas);
+    m_alloc.destroy(m_beamTlasScratchBuffer);
+    m_alloc.destroy(m_beamBuffer);
+    m_alloc.destroy(m_beamAsInfoBuffer);
+
+    m_maxNumBeams    = maxNumBeams;
+    m_maxNumSubBeams = maxNumSubBeams;
+    createBeamBuffers();
+    createBeamTlas();
+
+    VkDescriptorBufferInfo beamInfo{m_beamBuffer.buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo beamAsInfo{m_beamAsInfoBuffer.buffer, 0, VK_WHOLE_SIZE};
+
+    std::vector<VkWriteDescriptorSet> writes;
+    writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbPhotonBeam, &beamInfo));
+    writes.emplace_back(m_pbDescSetLayoutBind.makeWrite(m_pbDescSet, PbBindings::ePbPhotonBeamAs, &beamAsInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eBeamLookup, &beamInfo));
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    updateRtDescriptorSetBeamTlas();
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1527,17 +1864,16 @@ void HelloVulkan::createRtPipeline()
 //
 void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf)
 {
-    updateFrame();
-
     m_debug.beginLabel(cmdBuf, "Ray trace");
+    m_profiler.beginSection("Ray trace", cmdBuf);
 
     std::vector<VkDescriptorSet> descSets{m_rtDescSet, m_descSet};
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
     vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipelineLayout, 0,
                             (uint32_t)descSets.size(), descSets.data(), 0, nullptr);
 
-    m_pcRay.numBeamSources   = m_numBeamSamples;
-    m_pcRay.numPhotonSources = m_numPhotonSamples;
+    m_pcRay.numBeamSources   = getFrameBeamSamples();
+    m_pcRay.numPhotonSources = getFramePhotonSamples();
     vkCmdPushConstants(
         cmdBuf, 
         m_rtPipelineLayout,
@@ -1555,25 +1891,63 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf)
     );
 
 
+    m_profiler.endSection("Ray trace", cmdBuf);
     m_debug.endLabel(cmdBuf);
 }
 
 //--------------------------------------------------------------------------------------------------
-// If the camera matrix has changed, resets the frame.
+// If the camera matrix or the beam parameters have changed, resets the frame.
 // otherwise, increments frame.
+// The push constants are compared without the seeds, which change with every accumulated frame,
+// and with the source counts of the beam trace, which depend on the photon/beam toggles.
 //
 void HelloVulkan::updateFrame()
 {
-  static nvmath::mat4f refCamMatrix;
-  static float         refFov{CameraManip.getFov()};
+  static nvmath::mat4f   refCamMatrix;
+  static float           refFov{CameraManip.getFov()};
+  static PushConstantRay refPcRay{};
 
   const auto& m   = CameraManip.getMatrix();
   const auto  fov = CameraManip.getFov();
 
-  if(memcmp(&refCamMatrix.a00, &m.a00, sizeof(nvmath::mat4f)) != 0 || refFov != fov)
+  PushConstantRay pcRay  = m_pcRay;
+  pcRay.frame            = 0;
+  pcRay.seed             = 0;
+  pcRay.nextSeedRatio    = 0;
+  pcRay.numBeamSources   = m_usePhotonBeam ? getFrameBeamSamples() : 0;
+  pcRay.numPhotonSources = m_usePhotonMapping ? getFramePhotonSamples() : 0;
+
+  if(memcmp(&refCamMatrix.a00, &m.a00, sizeof(nvmath::mat4f)) != 0 || refFov != fov
+     || memcmp(&refPcRay, &pcRay, sizeof(PushConstantRay)) != 0 || !m_accumulate)
   {
+    resetFrame();
     refCamMatrix = m;
     refFov       = fov;
+    refPcRay     = pcRay;
   }
+  m_pcRay.frame++;
+
+  // A new set of beams for each accumulated frame, instead of the blend between two seeds of the light variation.
+  // Hashed, as m_randomSeed + frame would give again the seeds of the previous frames when m_randomSeed increases.
+  if(m_accumulate)
+  {
+    m_pcRay.seed          = hashSeed(uint32_t(m_pcRay.frame), m_randomSeed);
+    m_pcRay.nextSeedRatio = 0;
+  }
+}
+
+void HelloVulkan::resetFrame()
+{
+  m_pcRay.frame = -1;
+}
+
+uint32_t HelloVulkan::getFrameBeamSamples() const
+{
+  return m_accumulate ? MAX(1u, m_numBeamSamples / m_accumSampleDivisor) : m_numBeamSamples;
+}
+
+uint32_t HelloVulkan::getFramePhotonSamples() const
+{
+  return m_accumulate ? MAX(1u, m_numPhotonSamples / m_accumSampleDivisor) : m_numPhotonSamples;
 }
 
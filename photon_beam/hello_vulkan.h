@@ -21,6 +21,7 @@
 
 #include "shaders/host_device.h"
 
+#include "gpu_profiler.h"
 #include "nvvk/appbase_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
@@ -29,7 +30,7 @@
 
 // #VKRay
 #include "nvh/gltfscene.hpp"
-#include "nvvk/raytraceKHR_vk.hpp"
+#include "raytrace_builder.h"
 #include "nvvk/sbtwrapper_vk.hpp"
 
 
@@ -52,6 +53,7 @@ public:
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void resetBeamBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
   void setBeamPushConstants(const nvmath::vec4f& clearColor);
@@ -68,13 +70,31 @@ public:
   nvvk::Buffer m_beamBoxBuffer;
   nvvk::Buffer m_beamBuffer;
   nvvk::Buffer m_beamAsInfoBuffer;
-  nvvk::Buffer m_beamAsCountReadBuffer;
+  nvvk::Buffer m_beamAsCountReadBuffer;  // Beam counters copied after the beam trace, one slot per frame in flight
+  nvvk::Buffer m_beamAsBuildRangeBuffer;  // VkAccelerationStructureBuildRangeInfoKHR written by photonbeam.rgen
 
   nvvk::Buffer m_beamTlasScratchBuffer;
   nvvk::AccelKHR m_pbTlas;
 
+  uint32_t* m_beamCountReadback{nullptr};  // Mapped m_beamAsCountReadBuffer: sub-beam and beam counters of each slot
+  uint32_t  m_beamCountReadbackSlots{1};
+  uint32_t  m_beamCountFrame{0};           // Beam traces recorded so far
+  uint32_t  m_beamShrinkFrames{0};         // Consecutive readbacks with a buffer used below a quarter
+
+  nvvk::Buffer       m_emissionGuideBuffer;     // EmissionGuide
+  nvvk::Buffer       m_emissionReadBuffer;      // Histograms copied after the beam trace, one slot per frame in flight
+  uint32_t*          m_emissionReadback{nullptr};
+  std::vector<float> m_emissionAverage;         // Histogram averaged over the previous frames
+  std::vector<float> m_emissionCdf;
+
+  // Build the beam TLAS with vkCmdBuildAccelerationStructuresIndirectKHR, using the number of sub-beams 
+  // actually emitted by the beam trace. Requires accelerationStructureIndirectBuild feature.
+  bool m_useIndirectBeamBuild{false};
+
   float    m_airAlbedo{0.1f};
   float m_beamRadius{0.5f};
+  uint32_t m_beamSplitMode{eBeamSplitFixed};
+  float    m_beamSplitDistance{10.0f};  // eBeamSplitDistance: segments are 2 * radius long up to this distance
   float    m_photonRadius{0.5f};
   uint32_t m_numBeamSamples{1024};
   uint32_t m_numPhotonSamples{4 * 4 * 1024};
@@ -86,9 +106,16 @@ public:
   const uint32_t maxNumBeamSamples{2048};
   const uint32_t maxNumPhotonSamples{4 * 4 * 4096};
 
-  const uint32_t m_maxNumBeams{MAX(maxNumBeamSamples, maxNumPhotonSamples) * 32};
+  // Initial capacities, changed by updateBeamCapacity
+  uint32_t m_maxNumBeams{MAX(maxNumBeamSamples, maxNumPhotonSamples) * 32};
   // number of beam samples * (expected number of scatter  + surface intersection ) * (expected length of the beam / (radius * 2)) 
-  const uint32_t m_maxNumSubBeams{maxNumBeamSamples * 48 + maxNumPhotonSamples};
+  uint32_t m_maxNumSubBeams{maxNumBeamSamples * 48 + maxNumPhotonSamples};
+
+  // Beams and sub-beams requested by the beam trace a few frames ago, including the ones dropped when the buffers
+  // are full. With m_autoBeamCapacity, the buffers and the beam TLAS follow these counts.
+  uint32_t m_beamCount{0};
+  uint32_t m_subBeamCount{0};
+  bool     m_autoBeamCapacity{true};
 
 
   nvmath::vec4f m_beamNearColor;
@@ -98,6 +125,12 @@ public:
   bool          m_usePhotonBeam;
   float         m_hgAssymFactor;
   bool          m_showDirectColor;
+  bool          m_russianRoulette{true};  // Otherwise the light paths end below a fixed intensity
+  // The light directions are sampled proportionally to the paths reaching the scene in the previous frames,
+  // mixed with uniform sampling so that no direction is left out
+  bool          m_emissionGuiding{false};
+  float         m_emissionGuideUniform{0.25f};  // Probability of the uniform sampling
+  uint32_t      m_maxBounceDepth{16};     // Bounces of a light path, 0: no limit
 
   bool m_isLightMotionOn;
   bool m_isLightVariationOn;
@@ -129,6 +162,7 @@ public:
 
   nvvk::ResourceAllocatorDma m_alloc;  // Allocator for buffer, images, acceleration structures
   nvvk::DebugUtil            m_debug;  // Utility to name objects
+  GpuProfiler                m_profiler;  // GPU time of the passes
 
 
   // #Post - Draw the rendered image on a quad using a tonemapper
@@ -158,6 +192,13 @@ public:
   void createBottomLevelAS();
   void createTopLevelAS();
   void createBeamASResources();
+  void createBeamBuffers();
+  void createBeamTlas();
+  void updateBeamCapacity();
+  void resizeBeamBuffers(uint32_t maxNumBeams, uint32_t maxNumSubBeams);
+  void cmdReadBeamCounts(const VkCommandBuffer& cmdBuf);
+  void createEmissionGuide();
+  void updateEmissionGuide();
   void createRtDescriptorSet();
   void updateRtDescriptorSet();
   void updateRtDescriptorSetBeamTlas();
@@ -165,13 +206,22 @@ public:
 
   void createPbDescriptorSet();
   void createPbPipeline();
+  void prepareBeamTrace();
   void buildPbTlas(const nvmath::vec4f& clearColor, const VkCommandBuffer& cmdBuf);
 
   void raytrace(const VkCommandBuffer& cmdBuf);
   void updateFrame();
+  void resetFrame();
+
+  // Progressive accumulation: the ray traced frames are averaged while the camera, the light and the beam
+  // parameters do not change. Each frame then traces new beams, from its own seed.
+  bool     m_accumulate{false};
+  uint32_t m_accumSampleDivisor{4};  // The beam and photon counts are divided by this when accumulating
+  uint32_t getFrameBeamSamples() const;
+  uint32_t getFramePhotonSamples() const;
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-  nvvk::RaytracingBuilderKHR                      m_rtBuilder;
+  RaytracingBuilder                               m_rtBuilder;
   nvvk::DescriptorSetBindings                     m_rtDescSetLayoutBind;
   VkDescriptorPool                                m_rtDescPool;
   VkDescriptorSetLayout                           m_rtDescSetLayout;
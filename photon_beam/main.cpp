@@ -27,10 +27,12 @@
 #include "backends/imgui_impl_glfw.h"
 #include "imgui.h"
 
+#include "headless.h"
 #include "hello_vulkan.h"
 #include "imgui/imgui_camera_widget.h"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
+#include "nvh/nvprint.hpp"
 #include "nvpsystem.hpp"
 #include "nvvk/commands_vk.hpp"
 #include "nvvk/context_vk.hpp"
@@ -44,12 +46,6 @@
 std::vector<std::string> defaultSearchPaths;
 
 
-// GLFW Callback functions
-static void onErrorCallback(int error, const char* description)
-{
-    fprintf(stderr, "GLFW Error %d: %s\n", error, description);
-}
-
 // Extra UI
 void renderUI(HelloVulkan& helloVk, bool useRaytracer, uint32_t& numPhotons, uint32_t& numBeams)
 {
@@ -154,13 +150,43 @@ void renderUI(HelloVulkan& helloVk, bool useRaytracer, uint32_t& numPhotons, uin
         -0.99f, 0.99f
     );
 
+    const char* splitModes[] = {"Fixed (2 x radius)", "Single instance", "Camera distance"};
+    ImGui::Combo("Beam Split", reinterpret_cast<int*>(&helloVk.m_beamSplitMode), splitModes, IM_ARRAYSIZE(splitModes));
+    if(helloVk.m_beamSplitMode == eBeamSplitDistance)
+        ImGui::SliderFloat("Beam Split Distance", &helloVk.m_beamSplitDistance, 1.0f, 100.0f);
+
     ImGui::Checkbox("Surface Photon", &helloVk.m_usePhotonMapping);
     ImGui::Checkbox("Photon Beam", &helloVk.m_usePhotonBeam);
     ImGui::Checkbox("Show Solid Beam/Surface Color", &helloVk.m_showDirectColor);
 
+    ImGui::Checkbox("Russian Roulette", &helloVk.m_russianRoulette);
+    ImGui::Checkbox("Emission Guiding", &helloVk.m_emissionGuiding);
+    if(helloVk.m_emissionGuiding)
+        ImGui::SliderFloat("Uniform Emission", &helloVk.m_emissionGuideUniform, 0.05f, 1.0f);
+    const uint32_t minBounces = 0, maxBounces = 64;
+    ImGui::SliderScalar("Max Bounces", ImGuiDataType_U32, &helloVk.m_maxBounceDepth, &minBounces, &maxBounces,
+                        helloVk.m_maxBounceDepth == 0 ? "No limit" : "%u", ImGuiSliderFlags_None);
+
+    ImGui::Checkbox("Accumulate Frames", &helloVk.m_accumulate);
+    if(helloVk.m_accumulate)
+    {
+        const uint32_t minDivisor = 1, maxDivisor = 64;
+        ImGui::SliderScalar("Samples Divisor", ImGuiDataType_U32, &helloVk.m_accumSampleDivisor, &minDivisor, &maxDivisor, nullptr, ImGuiSliderFlags_None);
+        ImGui::Text("Accumulated frames: %d", helloVk.m_pcRay.frame + 1);
+    }
+
     ImGui::SliderScalar("Sample Beams", ImGuiDataType_U32, &numBeams, &minValBeam, &maxValBeam, nullptr, ImGuiSliderFlags_None);
     ImGui::SliderScalar("Sample Photons", ImGuiDataType_U32, &numPhotons, &minValPhoton, &maxValPhoton, nullptr, ImGuiSliderFlags_None);
 
+    // Counts read back a few frames late, above the capacity when beams are dropped
+    ImGui::Checkbox("Auto Beam Capacity", &helloVk.m_autoBeamCapacity);
+    const ImVec4 overflowColor(1.0f, 0.4f, 0.4f, 1.0f);
+    const ImVec4 textColor = ImGui::GetStyleColorVec4(ImGuiCol_Text);
+    ImGui::TextColored(helloVk.m_beamCount > helloVk.m_maxNumBeams ? overflowColor : textColor, "Beams: %u / %u",
+                       helloVk.m_beamCount, helloVk.m_maxNumBeams);
+    ImGui::TextColored(helloVk.m_subBeamCount > helloVk.m_maxNumSubBeams ? overflowColor : textColor,
+                       "Sub-beams: %u / %u", helloVk.m_subBeamCount, helloVk.m_maxNumSubBeams);
+
     if(ImGui::SmallButton("Set Defaults"))
         helloVk.setDefaults();
 }
@@ -177,28 +203,18 @@ static int const SAMPLE_HEIGHT = 900;
 //
 int main(int argc, char** argv)
 {
-    UNUSED(argc);
+    // Headless: no window, the frames are rendered in the offscreen image which is then saved
+    const HeadlessOptions headless = parseHeadlessOptions(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
-    // Setup GLFW window
-    glfwSetErrorCallback(onErrorCallback);
-    if(!glfwInit())
-    {
+    // Setup GLFW window, none in headless mode
+    GLFWwindow* window = nullptr;
+    if(!createSampleWindow(headless, SAMPLE_WIDTH, SAMPLE_HEIGHT, PROJECT_NAME, window))
         return 1;
-    }
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT, PROJECT_NAME, nullptr, nullptr);
 
     // Setup camera
     CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
     CameraManip.setLookat(nvmath::vec3f(0, 0, 15), nvmath::vec3f(0, 0, 0), nvmath::vec3f(0, 1, 0));
 
-    // Setup Vulkan
-    if(!glfwVulkanSupported())
-    {
-        printf("GLFW: Vulkan Not Supported\n");
-        return 1;
-    }
-
     // setup some basic things for the sample, logging file for example
     NVPSystem system(PROJECT_NAME);
 
@@ -209,18 +225,11 @@ int main(int argc, char** argv)
         std::string(PROJECT_NAME),
     };
 
-    // Vulkan required extensions
-    assert(glfwVulkanSupported() == 1);
-    uint32_t count{0};
-    auto     reqExtensions = glfwGetRequiredInstanceExtensions(&count);
-
     // Requesting Vulkan extensions and layers
     nvvk::ContextCreateInfo contextInfo;
-    contextInfo.setVersion(1, 2);                       // Using Vulkan 1.2
-    for(uint32_t ext_id = 0; ext_id < count; ext_id++)  // Adding required extensions (surface, win32, linux, ..)
-    contextInfo.addInstanceExtension(reqExtensions[ext_id]);
+    contextInfo.setVersion(1, 2);                      // Using Vulkan 1.2
+    addSampleWindowExtensions(headless, contextInfo);  // Surface and swapchain, none in headless mode
     contextInfo.addInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME, true);  // Allow debug names
-    contextInfo.addDeviceExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);            // Enabling ability to present rendering
 
     // #VKRay: Activate the ray tracing extension
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
@@ -261,26 +270,37 @@ int main(int argc, char** argv)
     // Create example
     HelloVulkan helloVk;
 
-    // Window need to be opened to get the surface on which to draw
-    const VkSurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
-    vkctx.setGCTQueueWithPresent(surface);
-
-    helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice, vkctx.m_queueGCT.familyIndex);
+    // Surface, swapchain and ImGui of the window, or only the rendering size in headless mode
+    setupSampleApp(headless, vkctx, helloVk, window, SAMPLE_WIDTH, SAMPLE_HEIGHT);
     helloVk.setDefaults();
+    // accelFeature holds the features supported and enabled by the device
+    helloVk.m_useIndirectBeamBuild = accelFeature.accelerationStructureIndirectBuild == VK_TRUE;
+    if(!helloVk.m_useIndirectBeamBuild)
+        LOGW("accelerationStructureIndirectBuild is not supported, building beam TLAS with the maximum number of sub-beams\n");
+
+    // Benchmark: fixed seed and sample counts of the scenario
+    if(!headless.benchmarkFile.empty())
+    {
+        const BenchmarkScenario& scenario = headless.benchmark;
+        helloVk.m_randomSeed              = scenario.seed;
+        helloVk.m_numBeamSamples          = uint32_t(scenario.getParam("beams", float(helloVk.m_numBeamSamples)));
+        helloVk.m_numPhotonSamples        = uint32_t(scenario.getParam("photons", float(helloVk.m_numPhotonSamples)));
+        helloVk.m_beamSplitMode           = uint32_t(scenario.getParam("beamSplit", float(helloVk.m_beamSplitMode)));
+        helloVk.m_beamSplitDistance       = scenario.getParam("beamSplitDistance", helloVk.m_beamSplitDistance);
+        helloVk.m_russianRoulette         = scenario.getParam("russianRoulette", helloVk.m_russianRoulette ? 1.f : 0.f) != 0.f;
+        helloVk.m_maxBounceDepth          = uint32_t(scenario.getParam("maxBounces", float(helloVk.m_maxBounceDepth)));
+        helloVk.m_emissionGuiding         = scenario.getParam("emissionGuiding", helloVk.m_emissionGuiding ? 1.f : 0.f) != 0.f;
+        helloVk.m_accumulate              = scenario.getParam("accumulate", helloVk.m_accumulate ? 1.f : 0.f) != 0.f;
+        helloVk.m_accumSampleDivisor      = MAX(1u, uint32_t(scenario.getParam("accumDivisor", float(helloVk.m_accumSampleDivisor))));
+    }
     uint32_t newNumBeams   = helloVk.m_numBeamSamples;
     uint32_t newNumPhotons = helloVk.m_numPhotonSamples;
-    helloVk.createSwapchain(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
-    helloVk.createDepthBuffer();
-    helloVk.createRenderPass();
-    helloVk.createFrameBuffers();
-
-    // Setup Imgui
-    helloVk.initGUI(0);  // Using sub-pass 0
 
     helloVk.createBeamBoundingBox();
 
     // Creation of the example
-    helloVk.loadScene(nvh::findFile("media/scenes/cornellBox.gltf", defaultSearchPaths, true));
+    const std::string scene = headless.benchmark.scene.empty() ? "media/scenes/cornellBox.gltf" : headless.benchmark.scene;
+    helloVk.loadScene(nvh::findFile(scene, defaultSearchPaths, true));
 
 
     helloVk.createOffscreenRender();
@@ -307,20 +327,40 @@ int main(int argc, char** argv)
     helloVk.createRtPipeline();
     helloVk.updateRtDescriptorSetBeamTlas();
 
-    helloVk.createPostDescriptor();
-    helloVk.createPostPipeline();
-    helloVk.updatePostDescriptorSet();
-
+    // The post-process renders in the swapchain
+    if(!headless.enabled)
+    {
+        helloVk.createPostDescriptor();
+        helloVk.createPostPipeline();
+        helloVk.updatePostDescriptorSet();
+    }
 
-    helloVk.setupGlfwCallbacks(window);
-    ImGui_ImplGlfw_InitForVulkan(window, true);
 
     bool isLightMotionOn;
     bool  isLightVariationOn;
     float lightVariationInterval = 30.0f;
 
+    // Headless: rendering the frames and saving the offscreen image, without post-process and UI
+    int result = 0;
+    if(headless.enabled)
+    {
+        auto renderFrame = [&](const VkCommandBuffer& cmdBuf, uint32_t /*frame*/) {
+            helloVk.m_profiler.beginFrame(cmdBuf);
+            // Fixed time step: the light variation only depends on the frame number
+            helloVk.addTime(headless.benchmark.frameTime);
+            helloVk.updateUniformBuffer(cmdBuf);
+            helloVk.setBeamPushConstants(clearColor);
+            helloVk.buildPbTlas(clearColor, cmdBuf);
+            helloVk.raytrace(cmdBuf);
+        };
+        auto prepareFrame = [&](uint32_t /*frame*/) { helloVk.prepareBeamTrace(); };
+        if(!renderHeadless(helloVk, helloVk.m_alloc, helloVk.m_offscreenColor.image, headless, renderFrame,
+                          &helloVk.m_profiler, {}, prepareFrame))
+            result = 1;
+    }
+
     // Main loop
-    while(!glfwWindowShouldClose(window))
+    while(!headless.enabled && !glfwWindowShouldClose(window))
     {
         glfwPollEvents();
         if(helloVk.isMinimized())
@@ -339,6 +379,7 @@ int main(int argc, char** argv)
             ImGui::Checkbox("Ray Tracer mode", &useRaytracer);  // Switch between raster and ray tracing
 
             renderUI(helloVk, useRaytracer, newNumPhotons, newNumBeams);
+            helloVk.m_profiler.renderUI();
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
             ImGuiH::Control::Info("", "", "(F10) Toggle Pane", ImGuiH::Control::Flags::Disabled);
@@ -349,6 +390,9 @@ int main(int argc, char** argv)
 
         // Start rendering the scene
         helloVk.prepareFrame();
+        // The frame using the same readback slot is complete, and the command buffer is not recorded yet
+        if(useRaytracer)
+            helloVk.prepareBeamTrace();
 
         // Start command buffer of this frame
         auto                   curFrame = helloVk.getCurFrame();
@@ -357,6 +401,7 @@ int main(int argc, char** argv)
         VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
         beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
         vkBeginCommandBuffer(cmdBuf, &beginInfo);
+        helloVk.m_profiler.beginFrame(cmdBuf);
 
         // Updating camera buffer
         helloVk.updateUniformBuffer(cmdBuf);
@@ -385,6 +430,8 @@ int main(int argc, char** argv)
             }
             else
             {
+                // The raster pass overwrites the accumulated image
+                helloVk.resetFrame();
                 vkCmdBeginRenderPass(cmdBuf, &offscreenRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
                 helloVk.rasterize(cmdBuf);
                 vkCmdEndRenderPass(cmdBuf);
@@ -421,8 +468,7 @@ int main(int argc, char** argv)
         helloVk.destroy();
         vkctx.deinit();
 
-        glfwDestroyWindow(window);
-        glfwTerminate();
+        destroySampleWindow(window);
 
-        return 0;
+        return result;
     }
@@ -59,7 +59,22 @@ START_BINDING(PbBindings)
   ePbTlas       = 0,  // Top-level acceleration structure
   ePbPrimLookup = 1,   // Lookup of objects
   ePbPhotonBeam  = 2,  
-  ePbPhotonBeamAs  = 3 
+  ePbPhotonBeamAs  = 3,
+  ePbPhotonBeamAsBuildRange = 4,  // GPU written build range of the beam TLAS
+  ePbEmissionGuide = 5  // EmissionGuide
+END_BINDING();
+
+START_BINDING(BeamSplitModes)
+  eBeamSplitFixed    = 0,  // Segments of 2 * beamRadius
+  eBeamSplitSingle   = 1,  // One elongated instance per beam
+  eBeamSplitDistance = 2   // Segments getting longer with the distance to the camera
+END_BINDING();
+
+START_BINDING(RayFlags)
+  eRayShowDirectColor = 1,  // Solid beam/surface color instead of the radiance
+  eRayRussianRoulette = 2,  // Light paths terminated by Russian roulette instead of an intensity threshold
+  eRayEmissionGuiding = 4,  // Light directions sampled from EmissionGuide instead of uniformly
+  eRayMaxBounceShift  = 8   // Maximum bounce depth of the light paths in the bits 8-15, 0: no limit
 END_BINDING();
 
 START_BINDING(MediaBindings)
@@ -79,6 +94,16 @@ struct SceneDesc
   uint64_t primInfoAddress;  // Address of the mesh primitives buffer (PrimMeshInfo)
 };
 
+// Emission guiding: the light directions are binned in cos(theta) x phi cells, all with the same solid angle
+#define EMISSION_GUIDE_RES 16u
+#define EMISSION_GUIDE_CELLS (EMISSION_GUIDE_RES * EMISSION_GUIDE_RES)
+
+struct EmissionGuide
+{
+  float cdf[EMISSION_GUIDE_CELLS];        // Sampling probabilities of the cells, accumulated. Written by the host
+  uint  histogram[EMISSION_GUIDE_CELLS];  // Light paths of the frame reaching the scene, for each emission cell
+};
+
 // Uniform buffer set at each frame
 struct GlobalUniforms
 {
@@ -102,8 +127,9 @@ struct PushConstantRaster
 // Push constant structure for the ray tracer
 struct PushConstantRay
 {
-  vec4  clearColor;
-  
+  vec3  clearColor;
+  int   frame;  // Frames accumulated in the output image before this one, 0: no history
+
   vec3  lightPosition;
   uint     maxNumBeams;
 
@@ -123,8 +149,11 @@ struct PushConstantRay
 
   uint numBeamSources;
   uint numPhotonSources;
-  uint showDirectColor;
+  uint flags;  // RayFlags
   float nextSeedRatio;
+
+  uint  beamSplitMode;      // BeamSplitModes: how the beams are split into beam box instances
+  float beamSplitDistance;  // eBeamSplitDistance: camera distance at which the segments get longer than 2 * beamRadius
 };
 
 // Structure used for retrieving the primitive information in the closest hit
@@ -145,14 +174,15 @@ struct GltfShadeMaterial
   uint   padding[2];
 };
 
+// 32 bytes, encoded and decoded by the functions of photonbeam.glsl
 struct PhotonBeam
 {
   vec3  startPos;
-  uint	mediaIndex;
-  vec3  endPos;
-  float radius;
-  vec3  lightColor;
-  int   hitInstanceIndex;
+  float length;            // Distance from startPos to the end of the beam
+  uint  direction;         // Unit direction, octahedral encoding in 2 x snorm16
+  float lightIntensity;    // Largest component of the light color
+  uint  lightColor;        // Light color divided by lightIntensity, 3 x unorm10
+  uint  mediaAndInstance;  // Media index in the high 16 bits, hit instance in the low 16 bits (0xFFFF: none)
 };
 
 struct ShaderVkAccelerationStructureInstanceKHR
@@ -163,6 +193,16 @@ struct ShaderVkAccelerationStructureInstanceKHR
   uint64_t                   accelerationStructureReference;
 };
 
+// Same layout as VkAccelerationStructureBuildRangeInfoKHR, 
+// written by the photon beam ray generation shader and read by the indirect beam TLAS build
+struct ShaderVkAccelerationStructureBuildRangeInfoKHR
+{
+  uint primitiveCount;
+  uint primitiveOffset;
+  uint firstVertex;
+  uint transformOffset;
+};
+
 struct Aabb
 {
   vec3 minimum;
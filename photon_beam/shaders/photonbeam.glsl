@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2019-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Encoding of the PhotonBeam records, include after host_device.h
+//
+// The beams are read for every candidate hit of the beam and photon intersection shaders: the record
+// is kept at 32 bytes. The end position is rebuilt from the direction and the length, and the light
+// color is stored as its largest component and a normalized 10 bit per channel color.
+
+
+vec2 octWrap(vec2 v)
+{
+  return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+uint encodeOctahedral(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  return packSnorm2x16(n.z >= 0.0 ? n.xy : octWrap(n.xy));
+}
+
+vec3 decodeOctahedral(uint value)
+{
+  vec2  e = unpackSnorm2x16(value);
+  vec3  n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+PhotonBeam encodePhotonBeam(vec3 startPos, vec3 endPos, vec3 lightColor, uint mediaIndex, int hitInstanceIndex)
+{
+  PhotonBeam beam;
+  const vec3 beamVec = endPos - startPos;
+  beam.startPos      = startPos;
+  beam.length        = length(beamVec);
+  beam.direction     = encodeOctahedral(beam.length > 0.0 ? beamVec / beam.length : vec3(0, 0, 1));
+
+  beam.lightIntensity = max(max(lightColor.x, lightColor.y), lightColor.z);
+  const uvec3 color   = uvec3(round(clamp(lightColor / max(beam.lightIntensity, 1e-20), 0.0, 1.0) * 1023.0));
+  beam.lightColor     = color.x | (color.y << 10) | (color.z << 20);
+
+  beam.mediaAndInstance = (mediaIndex << 16) | (uint(hitInstanceIndex) & 0xFFFFu);
+  return beam;
+}
+
+vec3 decodeBeamDirection(PhotonBeam beam)
+{
+  return decodeOctahedral(beam.direction);
+}
+
+vec3 beamEndPos(PhotonBeam beam)
+{
+  return beam.startPos + decodeBeamDirection(beam) * beam.length;
+}
+
+vec3 beamLightColor(PhotonBeam beam)
+{
+  const uvec3 color = uvec3(beam.lightColor, beam.lightColor >> 10, beam.lightColor >> 20) & 1023u;
+  return vec3(color) / 1023.0 * beam.lightIntensity;
+}
+
+uint beamMediaIndex(PhotonBeam beam)
+{
+  return beam.mediaAndInstance >> 16;
+}
+
+// -1 when the beam did not end on a surface
+int beamHitInstanceIndex(PhotonBeam beam)
+{
+  const uint index = beam.mediaAndInstance & 0xFFFFu;
+  return index == 0xFFFFu ? -1 : int(index);
+}
@@ -448,7 +448,8 @@ void HelloVulkan::initOffscreen()
 {
   m_offscreen.createFramebuffer(m_size);
   m_offscreen.createDescriptor();
-  m_offscreen.createPipeline(m_renderPass);
+  if(m_renderPass != VK_NULL_HANDLE)  // No swapchain render pass when headless
+    m_offscreen.createPipeline(m_renderPass);
   m_offscreen.updateDescriptorSet();
 }
 
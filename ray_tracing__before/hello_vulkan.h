@@ -46,6 +46,7 @@ public:
   void createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures);
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
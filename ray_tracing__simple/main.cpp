@@ -27,6 +27,7 @@
 #include "backends/imgui_impl_glfw.h"
 #include "imgui.h"
 
+#include "headless.h"
 #include "hello_vulkan.h"
 #include "imgui/imgui_camera_widget.h"
 #include "nvh/cameramanipulator.hpp"
@@ -44,12 +45,6 @@
 std::vector<std::string> defaultSearchPaths;
 
 
-// GLFW Callback functions
-static void onErrorCallback(int error, const char* description)
-{
-  fprintf(stderr, "GLFW Error %d: %s\n", error, description);
-}
-
 // Extra UI
 void renderUI(HelloVulkan& helloVk)
 {
@@ -77,29 +72,19 @@ static int const SAMPLE_HEIGHT = 720;
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // Headless: no window, the frames are rendered in the offscreen image which is then saved
+  const HeadlessOptions headless = parseHeadlessOptions(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
-  // Setup GLFW window
-  glfwSetErrorCallback(onErrorCallback);
-  if(!glfwInit())
-  {
+  // Setup GLFW window, none in headless mode
+  GLFWwindow* window = nullptr;
+  if(!createSampleWindow(headless, SAMPLE_WIDTH, SAMPLE_HEIGHT, PROJECT_NAME, window))
     return 1;
-  }
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT, PROJECT_NAME, nullptr, nullptr);
 
 
   // Setup camera
   CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
   CameraManip.setLookat(nvmath::vec3f(5, 4, -4), nvmath::vec3f(0, 1, 0), nvmath::vec3f(0, 1, 0));
 
-  // Setup Vulkan
-  if(!glfwVulkanSupported())
-  {
-    printf("GLFW: Vulkan Not Supported\n");
-    return 1;
-  }
-
   // setup some basic things for the sample, logging file for example
   NVPSystem system(PROJECT_NAME);
 
@@ -110,19 +95,12 @@ int main(int argc, char** argv)
       std::string(PROJECT_NAME),
   };
 
-  // Vulkan required extensions
-  assert(glfwVulkanSupported() == 1);
-  uint32_t count{0};
-  auto     reqExtensions = glfwGetRequiredInstanceExtensions(&count);
-
   // Requesting Vulkan extensions and layers
   nvvk::ContextCreateInfo contextInfo;
-  contextInfo.setVersion(1, 2);                       // Using Vulkan 1.2
-  for(uint32_t ext_id = 0; ext_id < count; ext_id++)  // Adding required extensions (surface, win32, linux, ..)
-    contextInfo.addInstanceExtension(reqExtensions[ext_id]);
+  contextInfo.setVersion(1, 2);                      // Using Vulkan 1.2
+  addSampleWindowExtensions(headless, contextInfo);  // Surface and swapchain, none in headless mode
   contextInfo.addInstanceLayer("VK_LAYER_LUNARG_monitor", true);              // FPS in titlebar
   contextInfo.addInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME, true);  // Allow debug names
-  contextInfo.addDeviceExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);            // Enabling ability to present rendering
 
   // #VKRay: Activate the ray tracing extension
   VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
@@ -143,18 +121,8 @@ int main(int argc, char** argv)
   // Create example
   HelloVulkan helloVk;
 
-  // Window need to be opened to get the surface on which to draw
-  const VkSurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
-  vkctx.setGCTQueueWithPresent(surface);
-
-  helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice, vkctx.m_queueGCT.familyIndex);
-  helloVk.createSwapchain(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
-  helloVk.createDepthBuffer();
-  helloVk.createRenderPass();
-  helloVk.createFrameBuffers();
-
-  // Setup Imgui
-  helloVk.initGUI(0);  // Using sub-pass 0
+  // Surface, swapchain and ImGui of the window, or only the rendering size in headless mode
+  setupSampleApp(headless, vkctx, helloVk, window, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
   // Creation of the example
   helloVk.loadModel(nvh::findFile("media/scenes/Medieval_building.obj", defaultSearchPaths, true));
@@ -175,20 +143,33 @@ int main(int argc, char** argv)
   helloVk.createRtPipeline();
   helloVk.createRtShaderBindingTable();
 
-  helloVk.createPostDescriptor();
-  helloVk.createPostPipeline();
-  helloVk.updatePostDescriptorSet();
+  // The post-process renders in the swapchain
+  if(!headless.enabled)
+  {
+    helloVk.createPostDescriptor();
+    helloVk.createPostPipeline();
+    helloVk.updatePostDescriptorSet();
+  }
 
 
   nvmath::vec4f clearColor   = nvmath::vec4f(1, 1, 1, 1.00f);
   bool          useRaytracer = true;
 
 
-  helloVk.setupGlfwCallbacks(window);
-  ImGui_ImplGlfw_InitForVulkan(window, true);
+  // Headless: rendering the frames and saving the offscreen image, without post-process and UI
+  int result = 0;
+  if(headless.enabled)
+  {
+    auto renderFrame = [&](const VkCommandBuffer& cmdBuf, uint32_t /*frame*/) {
+      helloVk.updateUniformBuffer(cmdBuf);
+      helloVk.raytrace(cmdBuf, clearColor);
+    };
+    if(!renderHeadless(helloVk, helloVk.m_alloc, helloVk.m_offscreenColor.image, headless, renderFrame))
+      result = 1;
+  }
 
   // Main loop
-  while(!glfwWindowShouldClose(window))
+  while(!headless.enabled && !glfwWindowShouldClose(window))
   {
     glfwPollEvents();
     if(helloVk.isMinimized())
@@ -283,8 +264,7 @@ int main(int argc, char** argv)
   helloVk.destroy();
   vkctx.deinit();
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  destroySampleWindow(window);
 
-  return 0;
+  return result;
 }
@@ -18,6 +18,7 @@
  */
 
 
+#include <algorithm>
 #include <sstream>
 
 
@@ -397,6 +398,10 @@ void HelloVulkan::destroyResources()
   vkDestroyPipelineLayout(m_device, m_compPipelineLayout, nullptr);
   vkDestroyDescriptorPool(m_device, m_compDescPool, nullptr);
   vkDestroyDescriptorSetLayout(m_device, m_compDescSetLayout, nullptr);
+  vkDestroyPipeline(m_device, m_compInstPipeline, nullptr);
+  vkDestroyPipelineLayout(m_device, m_compInstPipelineLayout, nullptr);
+  m_alloc.destroy(m_bInstanceAnim);
+  m_alloc.destroy(m_bTlasInstances);
 
   m_alloc.deinit();
 }
@@ -661,6 +666,7 @@ void HelloVulkan::createBottomLevelAS()
     // We could add more geometry in each BLAS, but we add only one for now
     m_blas.push_back(blas);
   }
+  m_rtBuilder.m_blasMaxRefits = 100;  // Rebuilding the refitted BLAS from time to time keeps their quality
   m_rtBuilder.buildBlas(m_blas, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR
                                     | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR);
 }
@@ -684,6 +690,9 @@ void HelloVulkan::createTopLevelAS()
 
   m_rtFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
   m_rtBuilder.buildTlas(m_tlas, m_rtFlags);
+
+  // One instance buffer per frame in flight for the updates (no swapchain in headless mode)
+  m_rtBuilder.m_tlasInstanceBufferCount = std::max(2u, m_swapChain.getImageCount());
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -875,8 +884,33 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& c
 //--------------------------------------------------------------------------------------------------
 // Making the Wuson running in circle
 //
-void HelloVulkan::animationInstances(float time)
+void HelloVulkan::animationInstances(const VkCommandBuffer& cmdBuf, float time)
 {
+  if(m_gpuInstanceAnimation)
+  {
+    // The previous TLAS update must be done reading the instances
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    PushConstantInstances pcInst{};
+    pcInst.instancesAddress = nvvk::getBufferDeviceAddress(m_device, m_bTlasInstances.buffer);
+    pcInst.animationAddress = nvvk::getBufferDeviceAddress(m_device, m_bInstanceAnim.buffer);
+    pcInst.time             = time;
+    pcInst.count            = m_nbAnimatedInstances;
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compInstPipeline);
+    vkCmdPushConstants(cmdBuf, m_compInstPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantInstances), &pcInst);
+    vkCmdDispatch(cmdBuf, (m_nbAnimatedInstances + 63) / 64, 1, 1);
+
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_rtBuilder.cmdUpdateTlas(cmdBuf, pcInst.instancesAddress, static_cast<uint32_t>(m_tlas.size()), m_rtFlags);
+    return;
+  }
+
   const auto  nbWuson     = static_cast<int32_t>(m_instances.size() - 2);  // All except sphere and plane
   const float deltaAngle  = 6.28318530718f / static_cast<float>(nbWuson);
   const float wusonLength = 3.f;
@@ -893,31 +927,87 @@ void HelloVulkan::animationInstances(float time)
     tinst.transform                           = nvvk::toTransformMatrixKHR(transform);
   }
 
-  // Updating the top level acceleration structure
-  m_rtBuilder.buildTlas(m_tlas, m_rtFlags, true);
+  // Updating the top level acceleration structure, after the BLAS refit of animationObject
+  m_rtBuilder.cmdUpdateTlas(cmdBuf, m_tlas, {{1, static_cast<uint32_t>(nbWuson)}}, m_rtFlags);  // Only the wusons moved
 }
 
 //--------------------------------------------------------------------------------------------------
 // Animating the sphere vertices using a compute shader
 //
-void HelloVulkan::animationObject(float time)
+// The compute, the BLAS refit and the rendering are in the same command buffer: the CPU does not wait
+// for the deformation, the barriers order the work on the GPU.
+//
+void HelloVulkan::animationObject(const VkCommandBuffer& cmdBuf, float time)
 {
-  const uint32_t sphereId = 2;
-  ObjModel&      model    = m_objModel[sphereId];
-
-  updateCompDescriptors(model.vertexBuffer);
+  ObjModel& model = m_objModel[m_sphereId];
 
-  nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
-  VkCommandBuffer   cmdBuf = genCmdBuf.createCommandBuffer();
+  // The previous frame must be done reading the vertices (raster, ray tracing, refit) before they are overwritten
+  vkCmdPipelineBarrier(cmdBuf,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                           | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
 
   vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compPipeline);
   vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compPipelineLayout, 0, 1, &m_compDescSet, 0, nullptr);
   vkCmdPushConstants(cmdBuf, m_compPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(float), &time);
   vkCmdDispatch(cmdBuf, model.nbVertices, 1, 1);
 
-  genCmdBuf.submitAndWait(cmdBuf);
-  m_rtBuilder.updateBlas(sphereId, m_blas[sphereId],
-                         VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR);
+  // The new vertices are read by the refit, the rasterizer and the closest hit shader
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+                           | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  // All the deformed BLAS would be in this list, refitted with a single build call
+  m_rtBuilder.cmdUpdateBlas(cmdBuf, {m_sphereId}, m_blas,
+                            VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Animation of the wusons on the GPU: the parameters of the ring of animationInstances are stored per
+// instance, and anim_instances.comp writes the transforms in a device copy of the TLAS instances.
+// The CPU does not touch the instances anymore, whatever their number.
+//
+void HelloVulkan::createInstanceAnimation()
+{
+  const auto  nbWuson     = static_cast<uint32_t>(m_instances.size() - 2);  // All except sphere and plane
+  const float deltaAngle  = 6.28318530718f / static_cast<float>(nbWuson);
+  const float wusonLength = 3.f;
+  const float radius      = wusonLength / (2.f * sin(deltaAngle / 2.0f));
+
+  std::vector<InstanceAnimation> animations(nbWuson);
+  for(uint32_t i = 0; i < nbWuson; i++)
+    animations[i] = {i + 1, i * deltaAngle, radius, 0.5f};
+  m_nbAnimatedInstances = nbWuson;
+
+  nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
+  auto              cmdBuf = cmdGen.createCommandBuffer();
+  m_bInstanceAnim  = m_alloc.createBuffer(cmdBuf, animations, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  m_bTlasInstances = m_alloc.createBuffer(cmdBuf, m_tlas,
+                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                              | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+  cmdGen.submitAndWait(cmdBuf);
+  m_alloc.finalizeAndReleaseStaging();
+  m_debug.setObjectName(m_bInstanceAnim.buffer, "InstanceAnimation");
+  m_debug.setObjectName(m_bTlasInstances.buffer, "TlasInstances");
+
+  VkPushConstantRange pushConstant{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantInstances)};
+
+  VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  createInfo.pushConstantRangeCount = 1;
+  createInfo.pPushConstantRanges    = &pushConstant;
+  vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_compInstPipelineLayout);
+
+  VkComputePipelineCreateInfo computePipelineCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+  computePipelineCreateInfo.layout = m_compInstPipelineLayout;
+  computePipelineCreateInfo.stage =
+      nvvk::createShaderStageInfo(m_device, nvh::loadFile("spv/anim_instances.comp.spv", true, defaultSearchPaths, true),
+                                  VK_SHADER_STAGE_COMPUTE_BIT);
+  vkCreateComputePipelines(m_device, {}, 1, &computePipelineCreateInfo, nullptr, &m_compInstPipeline);
+  vkDestroyShaderModule(m_device, computePipelineCreateInfo.stage.module, nullptr);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -27,7 +27,7 @@
 #include "shaders/host_device.h"
 
 // #VKRay
-#include "nvvk/raytraceKHR_vk.hpp"
+#include "raytrace_builder.h"
 #include "nvvk/sbtwrapper_vk.hpp"
 
 //--------------------------------------------------------------------------------------------------
@@ -50,6 +50,7 @@ public:
   void createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures);
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
@@ -136,7 +137,7 @@ public:
 
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-  nvvk::RaytracingBuilderKHR                      m_rtBuilder;
+  RaytracingBuilder                               m_rtBuilder;
   nvvk::DescriptorSetBindings                     m_rtDescSetLayoutBind;
   VkDescriptorPool                                m_rtDescPool;
   VkDescriptorSetLayout                           m_rtDescSetLayout;
@@ -153,8 +154,19 @@ public:
   PushConstantRay m_pcRay{};
 
   // #VK_animation
-  void animationInstances(float time);
-  void animationObject(float time);
+  // Recorded in the frame command buffer, before the rendering
+  void animationInstances(const VkCommandBuffer& cmdBuf, float time);
+  void animationObject(const VkCommandBuffer& cmdBuf, float time);
+  uint32_t m_sphereId{2};  // Object deformed by the compute shader
+
+  // #VK_animation on the GPU: the TLAS instances are written by anim_instances.comp
+  void createInstanceAnimation();
+  bool             m_gpuInstanceAnimation{false};  // Ray tracer only, the rasterizer uses m_instances
+  nvvk::Buffer     m_bInstanceAnim;                // InstanceAnimation of each wuson
+  nvvk::Buffer     m_bTlasInstances;               // Instances of the TLAS updates, written on the device
+  uint32_t         m_nbAnimatedInstances{0};
+  VkPipeline       m_compInstPipeline{VK_NULL_HANDLE};
+  VkPipelineLayout m_compInstPipelineLayout{VK_NULL_HANDLE};
 
   // #VK_compute
   void createCompDescriptors();
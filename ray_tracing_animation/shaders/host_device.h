@@ -91,6 +91,24 @@ struct PushConstantRay
   int   lightType;
 };
 
+// Ring animation of a TLAS instance, see anim_instances.comp
+struct InstanceAnimation
+{
+  uint  instanceId;  // Index in the TLAS instances
+  float angle;       // Position on the ring at time 0, in radians
+  float radius;      // Radius of the ring
+  float speed;       // Radians per second
+};
+
+// Push constant structure for the instance animation
+struct PushConstantInstances
+{
+  uint64_t instancesAddress;  // Address of the TLAS instances (VkAccelerationStructureInstanceKHR)
+  uint64_t animationAddress;  // Address of the InstanceAnimation buffer
+  float    time;
+  uint     count;  // Number of animated instances
+};
+
 struct Vertex  // See ObjLoader, copy of VertexObj, could be compressed for device
 {
   vec3 pos;
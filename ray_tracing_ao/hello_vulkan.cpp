@@ -18,6 +18,7 @@
  */
 
 
+#include <array>
 #include <sstream>
 
 
@@ -49,6 +50,7 @@ void HelloVulkan::setup(const VkInstance& instance, const VkDevice& device, cons
   AppBaseVk::setup(instance, device, physicalDevice, queueFamily);
   m_alloc.init(instance, device, physicalDevice);
   m_debug.setup(m_device);
+  m_profiler.init(m_device, physicalDevice, queueFamily);
   m_offscreenDepthFormat = nvvk::findDepthFormat(physicalDevice);
 }
 
@@ -379,6 +381,11 @@ void HelloVulkan::destroyResources()
   m_alloc.destroy(m_offscreenColor);
   m_alloc.destroy(m_gBuffer);
   m_alloc.destroy(m_aoBuffer);
+  m_alloc.destroy(m_gBufferPrev);
+  m_alloc.destroy(m_aoHistory);
+  m_alloc.destroy(m_aoHalf);
+  m_alloc.destroy(m_aoDenoised);
+  m_alloc.destroy(m_aoDenoiseTemp);
   m_alloc.destroy(m_offscreenDepth);
   vkDestroyPipeline(m_device, m_postPipeline, nullptr);
   vkDestroyPipelineLayout(m_device, m_postPipelineLayout, nullptr);
@@ -389,12 +396,21 @@ void HelloVulkan::destroyResources()
 
   // Compute
   vkDestroyPipeline(m_device, m_compPipeline, nullptr);
+  vkDestroyPipeline(m_device, m_compHalfPipeline, nullptr);
+  vkDestroyPipeline(m_device, m_compUpsamplePipeline, nullptr);
   vkDestroyPipelineLayout(m_device, m_compPipelineLayout, nullptr);
   vkDestroyDescriptorPool(m_device, m_compDescPool, nullptr);
   vkDestroyDescriptorSetLayout(m_device, m_compDescSetLayout, nullptr);
 
+  // Denoiser
+  vkDestroyPipeline(m_device, m_denoisePipeline, nullptr);
+  vkDestroyPipelineLayout(m_device, m_denoisePipelineLayout, nullptr);
+  vkDestroyDescriptorPool(m_device, m_denoiseDescPool, nullptr);
+  vkDestroyDescriptorSetLayout(m_device, m_denoiseDescSetLayout, nullptr);
+
   // #VKRay
   m_rtBuilder.destroy();
+  m_profiler.deinit();
   m_alloc.deinit();
 }
 
@@ -406,6 +422,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
   VkDeviceSize offset{0};
 
   m_debug.beginLabel(cmdBuf, "Rasterize");
+  m_profiler.beginSection("Rasterize", cmdBuf);
 
   // Dynamic Viewport
   setViewport(cmdBuf);
@@ -427,6 +444,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
     vkCmdBindIndexBuffer(cmdBuf, model.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
     vkCmdDrawIndexed(cmdBuf, model.nbIndices, 1, 0, 0, 0);
   }
+  m_profiler.endSection("Rasterize", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
@@ -438,6 +456,7 @@ void HelloVulkan::onResize(int /*w*/, int /*h*/)
   createOffscreenRender();
   updatePostDescriptorSet();
   updateCompDescriptors();
+  updateDenoiserDescriptors();
   resetFrame();
 }
 
@@ -455,7 +474,13 @@ void HelloVulkan::createOffscreenRender()
   m_alloc.destroy(m_offscreenColor);
   m_alloc.destroy(m_gBuffer);
   m_alloc.destroy(m_aoBuffer);
+  m_alloc.destroy(m_gBufferPrev);
+  m_alloc.destroy(m_aoHistory);
+  m_alloc.destroy(m_aoHalf);
+  m_alloc.destroy(m_aoDenoised);
+  m_alloc.destroy(m_aoDenoiseTemp);
   m_alloc.destroy(m_offscreenDepth);
+  m_aoHistoryValid = false;
 
   VkSamplerCreateInfo sampler{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
 
@@ -477,7 +502,7 @@ void HelloVulkan::createOffscreenRender()
   {
     auto colorCreateInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32B32A32_SFLOAT,
                                                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-                                                           | VK_IMAGE_USAGE_STORAGE_BIT);
+                                                           | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
 
     nvvk::Image           image      = m_alloc.createImage(colorCreateInfo);
@@ -487,11 +512,11 @@ void HelloVulkan::createOffscreenRender()
     m_debug.setObjectName(m_gBuffer.image, "G-Buffer");
   }
 
-  // The ambient occlusion result (r32)
+  // The ambient occlusion result (rg32) - AO / number of frames blended
   {
-    auto colorCreateInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32_SFLOAT,
+    auto colorCreateInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32_SFLOAT,
                                                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-                                                           | VK_IMAGE_USAGE_STORAGE_BIT);
+                                                           | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
 
     nvvk::Image           image       = m_alloc.createImage(colorCreateInfo);
@@ -501,6 +526,51 @@ void HelloVulkan::createOffscreenRender()
     m_debug.setObjectName(m_aoBuffer.image, "aoBuffer");
   }
 
+  // History of the temporal reprojection: copies of the G-Buffer and of the AO
+  {
+    auto gBufInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32B32A32_SFLOAT,
+                                                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    nvvk::Image gBufImage                = m_alloc.createImage(gBufInfo);
+    m_gBufferPrev                        = m_alloc.createTexture(gBufImage, nvvk::makeImageViewCreateInfo(gBufImage.image, gBufInfo));
+    m_gBufferPrev.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_gBufferPrev.image, "G-Buffer history");
+
+    auto aoInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32_SFLOAT,
+                                              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    nvvk::Image aoImage                = m_alloc.createImage(aoInfo);
+    m_aoHistory                        = m_alloc.createTexture(aoImage, nvvk::makeImageViewCreateInfo(aoImage.image, aoInfo));
+    m_aoHistory.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_aoHistory.image, "AO history");
+  }
+
+  // The ambient occlusion traced at half resolution (r32), before upsampling
+  {
+    VkExtent2D  halfSize{(m_size.width + 1) / 2, (m_size.height + 1) / 2};
+    auto        halfInfo = nvvk::makeImage2DCreateInfo(halfSize, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+    nvvk::Image image    = m_alloc.createImage(halfInfo);
+    m_aoHalf             = m_alloc.createTexture(image, nvvk::makeImageViewCreateInfo(image.image, halfInfo));
+    m_aoHalf.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_aoHalf.image, "AO half resolution");
+  }
+
+  // The denoised AO (rg32) and the intermediate image of the denoiser iterations
+  {
+    auto denoisedInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32_SFLOAT,
+                                                    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT
+                                                        | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);  // Saved in headless mode
+    nvvk::Image           denoisedImage = m_alloc.createImage(denoisedInfo);
+    VkImageViewCreateInfo ivInfo        = nvvk::makeImageViewCreateInfo(denoisedImage.image, denoisedInfo);
+    m_aoDenoised                        = m_alloc.createTexture(denoisedImage, ivInfo, sampler);
+    m_aoDenoised.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_aoDenoised.image, "AO denoised");
+
+    auto        tempInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+    nvvk::Image tempImage                  = m_alloc.createImage(tempInfo);
+    m_aoDenoiseTemp                        = m_alloc.createTexture(tempImage, nvvk::makeImageViewCreateInfo(tempImage.image, tempInfo));
+    m_aoDenoiseTemp.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_aoDenoiseTemp.image, "AO denoise temp");
+  }
+
 
   // Creating the depth buffer
   auto depthCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
@@ -524,6 +594,11 @@ void HelloVulkan::createOffscreenRender()
     nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
     nvvk::cmdBarrierImageLayout(cmdBuf, m_gBuffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
     nvvk::cmdBarrierImageLayout(cmdBuf, m_aoBuffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_gBufferPrev.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_aoHistory.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_aoHalf.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_aoDenoised.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_aoDenoiseTemp.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
     nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenDepth.image, VK_IMAGE_LAYOUT_UNDEFINED,
                                 VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
 
@@ -587,9 +662,10 @@ void HelloVulkan::createPostDescriptor()
 {
   m_postDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
   m_postDescSetLayoutBind.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
-  m_postDescSetLayout = m_postDescSetLayoutBind.createLayout(m_device);
-  m_postDescPool      = m_postDescSetLayoutBind.createPool(m_device);
-  m_postDescSet       = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
+  m_postDescSetLayout   = m_postDescSetLayoutBind.createLayout(m_device);
+  m_postDescPool        = m_postDescSetLayoutBind.createPool(m_device, 2);
+  m_postDescSet         = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
+  m_postDenoisedDescSet = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -600,6 +676,8 @@ void HelloVulkan::updatePostDescriptorSet()
   std::vector<VkWriteDescriptorSet> writes;
   writes.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDescSet, 0, &m_offscreenColor.descriptor));
   writes.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDescSet, 1, &m_aoBuffer.descriptor));
+  writes.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDenoisedDescSet, 0, &m_offscreenColor.descriptor));
+  writes.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDenoisedDescSet, 1, &m_aoDenoised.descriptor));
   vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
@@ -609,15 +687,18 @@ void HelloVulkan::updatePostDescriptorSet()
 void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
 {
   m_debug.beginLabel(cmdBuf, "Post");
+  m_profiler.beginSection("Post", cmdBuf);
 
   setViewport(cmdBuf);
 
   auto aspectRatio = static_cast<float>(m_size.width) / static_cast<float>(m_size.height);
   vkCmdPushConstants(cmdBuf, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &aspectRatio);
   vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
-  vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &m_postDescSet, 0, nullptr);
+  VkDescriptorSet postDescSet = m_denoiseIterations > 0 ? m_postDenoisedDescSet : m_postDescSet;
+  vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &postDescSet, 0, nullptr);
   vkCmdDraw(cmdBuf, 3, 1, 0, 0);
 
+  m_profiler.endSection("Post", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
@@ -697,7 +778,9 @@ void HelloVulkan::createBottomLevelAS()
     // We could add more geometry in each BLAS, but we add only one for now
     allBlas.emplace_back(blas);
   }
-  m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+  // The geometry is static: compacting the BLAS after the build
+  m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                                     | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -734,6 +817,9 @@ void HelloVulkan::createCompDescriptors()
   m_compDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] G-Buffer
   m_compDescSetLayoutBind.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [out] AO
   m_compDescSetLayoutBind.addBinding(2, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] TLAS
+  m_compDescSetLayoutBind.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] G-Buffer history
+  m_compDescSetLayoutBind.addBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] AO history
+  m_compDescSetLayoutBind.addBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in/out] AO half res
 
   m_compDescSetLayout = m_compDescSetLayoutBind.createLayout(m_device);
   m_compDescPool      = m_compDescSetLayoutBind.createPool(m_device, 1);
@@ -754,6 +840,9 @@ void HelloVulkan::updateCompDescriptors()
   descASInfo.accelerationStructureCount = 1;
   descASInfo.pAccelerationStructures    = &tlas;
   writes.emplace_back(m_compDescSetLayoutBind.makeWrite(m_compDescSet, 2, &descASInfo));
+  writes.emplace_back(m_compDescSetLayoutBind.makeWrite(m_compDescSet, 3, &m_gBufferPrev.descriptor));
+  writes.emplace_back(m_compDescSetLayoutBind.makeWrite(m_compDescSet, 4, &m_aoHistory.descriptor));
+  writes.emplace_back(m_compDescSetLayoutBind.makeWrite(m_compDescSet, 5, &m_aoHalf.descriptor));
 
   vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
@@ -777,7 +866,15 @@ void HelloVulkan::createCompPipelines()
   cpCreateInfo.stage = nvvk::createShaderStageInfo(m_device, nvh::loadFile("spv/ao.comp.spv", true, defaultSearchPaths, true),
                                                    VK_SHADER_STAGE_COMPUTE_BIT);
 
-  vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_compPipeline);
+  // The same shader for the three passes, selected by the AO_PASS specialization constant
+  std::array<VkPipeline*, 3> pipelines{&m_compPipeline, &m_compHalfPipeline, &m_compUpsamplePipeline};
+  for(int32_t pass = 0; pass < static_cast<int32_t>(pipelines.size()); pass++)
+  {
+    VkSpecializationMapEntry specEntry{0, 0, sizeof(int32_t)};
+    VkSpecializationInfo     specInfo{1, &specEntry, sizeof(int32_t), &pass};
+    cpCreateInfo.stage.pSpecializationInfo = &specInfo;
+    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, pipelines[pass]);
+  }
 
   vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
 }
@@ -795,6 +892,20 @@ void HelloVulkan::runCompute(VkCommandBuffer cmdBuf, AoControl& aoControl)
     return;
 
   m_debug.beginLabel(cmdBuf, "Compute");
+  m_profiler.beginSection("AO compute", cmdBuf);
+
+  // Temporal reprojection: without history, the G-Buffer history is cleared so no surface is found in it
+  const bool          temporal    = aoControl.temporal != 0;
+  const float         aspectRatio = m_size.width / static_cast<float>(m_size.height);
+  const nvmath::mat4f viewProj =
+      nvmath::perspectiveVK(CameraManip.getFov(), aspectRatio, 0.1f, 1000.0f) * CameraManip.getMatrix();
+  if(temporal && !m_aoHistoryValid)
+  {
+    VkClearColorValue       clearValue{{0, 0, 0, 0}};
+    VkImageSubresourceRange clearRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(cmdBuf, m_gBufferPrev.image, VK_IMAGE_LAYOUT_GENERAL, &clearValue, 1, &clearRange);
+    m_aoHistoryViewProj = viewProj;
+  }
 
   // Adding a barrier to be sure the fragment has finished writing to the G-Buffer
   // before the compute shader is using the buffer
@@ -810,17 +921,50 @@ void HelloVulkan::runCompute(VkCommandBuffer cmdBuf, AoControl& aoControl)
   vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                        VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &imgMemBarrier);
 
+  // The history copies (or the clear) are done before the compute shader reads them
+  if(temporal)
+  {
+    std::array<VkImageMemoryBarrier, 2> historyBarriers{imgMemBarrier, imgMemBarrier};
+    historyBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    historyBarriers[0].image         = m_gBufferPrev.image;
+    historyBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    historyBarriers[1].image         = m_aoHistory.image;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, uint32_t(historyBarriers.size()),
+                         historyBarriers.data());
+  }
+
 
   // Preparing for the compute shader
-  vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compPipeline);
   vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compPipelineLayout, 0, 1, &m_compDescSet, 0, nullptr);
 
 
   // Sending the push constant information
-  aoControl.frame = m_frame;
+  aoControl.frame          = m_frame;
+  aoControl.frame_seed     = m_aoFrameSeed++;
+  aoControl.prev_view_proj = m_aoHistoryViewProj;
   vkCmdPushConstants(cmdBuf, m_compPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(AoControl), &aoControl);
 
   // Dispatching the shader
+  if(m_aoHalfRes)
+  {
+    // Tracing a quarter of the pixels, then upsampling them in the AO buffer
+    const uint32_t halfWidth  = (m_size.width + 1) / 2;
+    const uint32_t halfHeight = (m_size.height + 1) / 2;
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compHalfPipeline);
+    vkCmdDispatch(cmdBuf, (halfWidth + (GROUP_SIZE - 1)) / GROUP_SIZE, (halfHeight + (GROUP_SIZE - 1)) / GROUP_SIZE, 1);
+
+    VkImageMemoryBarrier halfBarrier = imgMemBarrier;
+    halfBarrier.image                = m_aoHalf.image;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &halfBarrier);
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compUpsamplePipeline);
+  }
+  else
+  {
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compPipeline);
+  }
   vkCmdDispatch(cmdBuf, (m_size.width + (GROUP_SIZE - 1)) / GROUP_SIZE, (m_size.height + (GROUP_SIZE - 1)) / GROUP_SIZE, 1);
 
 
@@ -830,7 +974,154 @@ void HelloVulkan::runCompute(VkCommandBuffer cmdBuf, AoControl& aoControl)
   vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
                        VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &imgMemBarrier);
 
+  // Keeping the G-Buffer and the AO of this frame for the reprojection of the next one
+  if(temporal)
+  {
+    cmdCopyAoHistory(cmdBuf);
+    m_aoHistoryViewProj = viewProj;
+  }
+  m_aoHistoryValid = temporal;
+
+
+  m_profiler.endSection("AO compute", cmdBuf);
+  m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Copying the G-Buffer and the AO to the history images read by the next frame
+//
+void HelloVulkan::cmdCopyAoHistory(VkCommandBuffer cmdBuf)
+{
+  VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  VkImageMemoryBarrier    barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  barrier.oldLayout        = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.newLayout        = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.subresourceRange = range;
+
+  // Sources written by the compute shader (AO) or the fragment shader (G-Buffer),
+  // destinations read by the compute shader
+  std::array<VkImageMemoryBarrier, 4> barriers{barrier, barrier, barrier, barrier};
+  barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[0].image         = m_aoBuffer.image;
+  barriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[1].image         = m_gBuffer.image;
+  barriers[2].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[2].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[2].image         = m_aoHistory.image;
+  barriers[3].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[3].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[3].image         = m_gBufferPrev.image;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr,
+                       uint32_t(barriers.size()), barriers.data());
+
+  VkImageCopy region{};
+  region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.extent         = {m_size.width, m_size.height, 1};
+  vkCmdCopyImage(cmdBuf, m_aoBuffer.image, VK_IMAGE_LAYOUT_GENERAL, m_aoHistory.image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+  vkCmdCopyImage(cmdBuf, m_gBuffer.image, VK_IMAGE_LAYOUT_GENERAL, m_gBufferPrev.image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+
+  // The G-Buffer is rendered again by the next frame
+  barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &barriers[1]);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The denoiser: one compute pipeline, and a descriptor set for each pair of images it reads and writes
+//
+void HelloVulkan::createDenoiser()
+{
+  m_denoiseDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] G-Buffer
+  m_denoiseDescSetLayoutBind.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] AO
+  m_denoiseDescSetLayoutBind.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [out] AO
+
+  m_denoiseDescSetLayout = m_denoiseDescSetLayoutBind.createLayout(m_device);
+  m_denoiseDescPool      = m_denoiseDescSetLayoutBind.createPool(m_device, static_cast<uint32_t>(m_denoiseDescSets.size()));
+  for(auto& descSet : m_denoiseDescSets)
+    descSet = nvvk::allocateDescriptorSet(m_device, m_denoiseDescPool, m_denoiseDescSetLayout);
+
+  VkPushConstantRange        pushConstants = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise)};
+  VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  plCreateInfo.setLayoutCount         = 1;
+  plCreateInfo.pSetLayouts            = &m_denoiseDescSetLayout;
+  plCreateInfo.pushConstantRangeCount = 1;
+  plCreateInfo.pPushConstantRanges    = &pushConstants;
+  vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_denoisePipelineLayout);
+
+  VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+  cpCreateInfo.layout = m_denoisePipelineLayout;
+  cpCreateInfo.stage  = nvvk::createShaderStageInfo(m_device, nvh::loadFile("spv/atrous.comp.spv", true, defaultSearchPaths, true),
+                                                   VK_SHADER_STAGE_COMPUTE_BIT);
+  vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_denoisePipeline);
+  vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The iterations alternate between m_aoDenoiseTemp and m_aoDenoised, the first one reading the AO buffer
+//
+void HelloVulkan::updateDenoiserDescriptors()
+{
+  const std::array<const nvvk::Texture*, 4> inputs{&m_aoBuffer, &m_aoBuffer, &m_aoDenoiseTemp, &m_aoDenoised};
+  const std::array<const nvvk::Texture*, 4> outputs{&m_aoDenoised, &m_aoDenoiseTemp, &m_aoDenoised, &m_aoDenoiseTemp};
+
+  std::vector<VkWriteDescriptorSet> writes;
+  for(size_t i = 0; i < m_denoiseDescSets.size(); i++)
+  {
+    writes.emplace_back(m_denoiseDescSetLayoutBind.makeWrite(m_denoiseDescSets[i], 0, &m_gBuffer.descriptor));
+    writes.emplace_back(m_denoiseDescSetLayoutBind.makeWrite(m_denoiseDescSets[i], 1, &inputs[i]->descriptor));
+    writes.emplace_back(m_denoiseDescSetLayoutBind.makeWrite(m_denoiseDescSets[i], 2, &outputs[i]->descriptor));
+  }
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Filtering the AO buffer into m_aoDenoised, with m_denoiseIterations passes of the a-trous filter
+//
+void HelloVulkan::runDenoiser(VkCommandBuffer cmdBuf)
+{
+  if(m_denoiseIterations <= 0)
+    return;
+
+  m_debug.beginLabel(cmdBuf, "Denoiser");
+  m_profiler.beginSection("Denoiser", cmdBuf);
+
+  // The G-Buffer, the AO, and the reads of the post-process of the previous frame are done
+  VkMemoryBarrier memBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  memBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  memBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmdBuf,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+                           | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
+  PushConstantDenoise pcDenoise = m_pcDenoise;
+  for(int i = 0; i < m_denoiseIterations; i++)
+  {
+    // Writing m_aoDenoised when the number of iterations left is odd, so that the last one ends there
+    const bool toDenoised = (m_denoiseIterations - i) % 2 == 1;
+    const int  descSetId  = (i == 0 ? 0 : 2) + (toDenoised ? 0 : 1);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipelineLayout, 0, 1,
+                            &m_denoiseDescSets[descSetId], 0, nullptr);
+
+    pcDenoise.stepWidth = 1 << i;
+    pcDenoise.colorPhi  = m_pcDenoise.colorPhi / static_cast<float>(1 << i);
+    vkCmdPushConstants(cmdBuf, m_denoisePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise), &pcDenoise);
+    vkCmdDispatch(cmdBuf, (m_size.width + (GROUP_SIZE - 1)) / GROUP_SIZE, (m_size.height + (GROUP_SIZE - 1)) / GROUP_SIZE, 1);
+
+    // Next iteration, or the post-process
+    memBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1,
+                         &memBarrier, 0, nullptr, 0, nullptr);
+  }
 
+  m_profiler.endSection("Denoiser", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
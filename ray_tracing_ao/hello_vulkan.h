@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "gpu_profiler.h"
 #include "nvvk/appbase_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
@@ -26,17 +27,23 @@
 #include "nvvk/resourceallocator_vk.hpp"
 #include "shaders/host_device.h"
 
+#include <array>
+
 // #VKRay
-#include "nvvk/raytraceKHR_vk.hpp"
+#include "raytrace_builder.h"
 
 struct AoControl
 {
-  float rtao_radius{2.0f};       // Length of the ray
-  int   rtao_samples{4};         // Nb samples at each iteration
-  float rtao_power{3.0f};        // Darkness is stronger for more hits
-  int   rtao_distance_based{1};  // Attenuate based on distance
-  int   frame{0};                // Current frame
-  int   max_samples{100'000};    // Max samples before it stops
+  float         rtao_radius{2.0f};       // Length of the ray
+  int           rtao_samples{4};         // Nb samples at each iteration
+  float         rtao_power{3.0f};        // Darkness is stronger for more hits
+  int           rtao_distance_based{1};  // Attenuate based on distance
+  int           frame{0};                // Current frame
+  int           max_samples{100'000};    // Max samples before it stops
+  int           temporal{1};             // Reproject the AO of the previous frames when the camera moves
+  int           max_history{32};         // Frames blended at most while the camera moves
+  int           frame_seed{0};           // Set by runCompute: frames computed, seeds the random numbers
+  nvmath::mat4f prev_view_proj;          // Set by runCompute: view-projection of the frame in the history
 };
 
 
@@ -60,6 +67,7 @@ public:
   void createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures);
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
@@ -112,6 +120,7 @@ public:
 
   nvvk::ResourceAllocatorDma m_alloc;  // Allocator for buffer, images, acceleration structures
   nvvk::DebugUtil            m_debug;  // Utility to name objects
+  GpuProfiler                m_profiler;  // GPU time of the passes
 
 
   // #Post - Draw the rendered image on a quad using a tonemapper
@@ -135,6 +144,9 @@ public:
   VkFormat                    m_offscreenDepthFormat{VK_FORMAT_X8_D24_UNORM_PACK32};
   nvvk::Texture               m_gBuffer;
   nvvk::Texture               m_aoBuffer;
+  nvvk::Texture               m_gBufferPrev;  // Temporal reprojection: G-Buffer and AO of the last AO frame
+  nvvk::Texture               m_aoHistory;
+  nvvk::Texture               m_aoHalf;  // AO traced at half resolution, see m_aoHalfRes
 
   // #Tuto_rayquery
   void initRayTracing();
@@ -144,7 +156,7 @@ public:
 
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-  nvvk::RaytracingBuilderKHR                      m_rtBuilder;
+  RaytracingBuilder                               m_rtBuilder;
 
 
   // #Tuto_animation
@@ -152,13 +164,37 @@ public:
   void updateCompDescriptors();
   void createCompPipelines();
   void runCompute(VkCommandBuffer cmdBuf, AoControl& aoControl);
+  void cmdCopyAoHistory(VkCommandBuffer cmdBuf);
 
   nvvk::DescriptorSetBindings m_compDescSetLayoutBind;
   VkDescriptorPool            m_compDescPool;
   VkDescriptorSetLayout       m_compDescSetLayout;
   VkDescriptorSet             m_compDescSet;
   VkPipeline                  m_compPipeline;
+  VkPipeline                  m_compHalfPipeline;      // Tracing at half resolution
+  VkPipeline                  m_compUpsamplePipeline;  // Joint bilateral upsampling to the AO buffer
   VkPipelineLayout            m_compPipelineLayout;
+  bool                        m_aoHistoryValid{false};
+  int                         m_aoFrameSeed{0};
+  bool                        m_aoHalfRes{false};  // Tracing one pixel of each 2x2 block
+  nvmath::mat4f               m_aoHistoryViewProj;
+
+  // #Denoiser - a-trous wavelet filter of the AO, guided by the G-Buffer
+  void createDenoiser();
+  void updateDenoiserDescriptors();
+  void runDenoiser(VkCommandBuffer cmdBuf);
+
+  nvvk::Texture                  m_aoDenoised;     // Result of the last iteration, displayed by the post-process
+  nvvk::Texture                  m_aoDenoiseTemp;  // Ping-pong with m_aoDenoised
+  nvvk::DescriptorSetBindings    m_denoiseDescSetLayoutBind;
+  VkDescriptorPool               m_denoiseDescPool{VK_NULL_HANDLE};
+  VkDescriptorSetLayout          m_denoiseDescSetLayout{VK_NULL_HANDLE};
+  std::array<VkDescriptorSet, 4> m_denoiseDescSets{};  // AO->denoised, AO->temp, temp->denoised, denoised->temp
+  VkPipeline                     m_denoisePipeline{VK_NULL_HANDLE};
+  VkPipelineLayout               m_denoisePipelineLayout{VK_NULL_HANDLE};
+  VkDescriptorSet                m_postDenoisedDescSet{VK_NULL_HANDLE};  // Post-process reading m_aoDenoised
+  int                            m_denoiseIterations{0};                 // 0: no filtering
+  PushConstantDenoise            m_pcDenoise{1, 0.5f, 0.5f, 0.3f};
 
   // #Tuto_jitter_cam
   void updateFrame();
@@ -28,6 +28,7 @@
 #include "backends/imgui_impl_glfw.h"
 #include "imgui.h"
 
+#include "headless.h"
 #include "hello_vulkan.h"
 #include "imgui/imgui_camera_widget.h"
 #include "nvh/cameramanipulator.hpp"
@@ -45,12 +46,6 @@
 std::vector<std::string> defaultSearchPaths;
 
 
-// GLFW Callback functions
-static void onErrorCallback(int error, const char* description)
-{
-  fprintf(stderr, "GLFW Error %d: %s\n", error, description);
-}
-
 // Extra UI
 void renderUI(HelloVulkan& helloVk)
 {
@@ -78,29 +73,19 @@ static int const SAMPLE_HEIGHT = 720;
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // Headless: no window, the frames are rendered in the offscreen image which is then saved
+  const HeadlessOptions headless = parseHeadlessOptions(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
-  // Setup GLFW window
-  glfwSetErrorCallback(onErrorCallback);
-  if(!glfwInit())
-  {
+  // Setup GLFW window, none in headless mode
+  GLFWwindow* window = nullptr;
+  if(!createSampleWindow(headless, SAMPLE_WIDTH, SAMPLE_HEIGHT, PROJECT_NAME, window))
     return 1;
-  }
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT, PROJECT_NAME, nullptr, nullptr);
 
 
   // Setup camera
   CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
   CameraManip.setLookat(nvmath::vec3f(5, 4, -4), nvmath::vec3f(0, 1, 0), nvmath::vec3f(0, 1, 0));
 
-  // Setup Vulkan
-  if(!glfwVulkanSupported())
-  {
-    printf("GLFW: Vulkan Not Supported\n");
-    return 1;
-  }
-
   // setup some basic things for the sample, logging file for example
   NVPSystem system(PROJECT_NAME);
 
@@ -111,19 +96,12 @@ int main(int argc, char** argv)
       std::string(PROJECT_NAME),
   };
 
-  // Vulkan required extensions
-  assert(glfwVulkanSupported() == 1);
-  uint32_t count{0};
-  auto     reqExtensions = glfwGetRequiredInstanceExtensions(&count);
-
   // Requesting Vulkan extensions and layers
   nvvk::ContextCreateInfo contextInfo;
-  contextInfo.setVersion(1, 2);                       // Using Vulkan 1.2
-  for(uint32_t ext_id = 0; ext_id < count; ext_id++)  // Adding required extensions (surface, win32, linux, ..)
-    contextInfo.addInstanceExtension(reqExtensions[ext_id]);
+  contextInfo.setVersion(1, 2);                      // Using Vulkan 1.2
+  addSampleWindowExtensions(headless, contextInfo);  // Surface and swapchain, none in headless mode
   contextInfo.addInstanceLayer("VK_LAYER_LUNARG_monitor", true);              // FPS in titlebar
   contextInfo.addInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME, true);  // Allow debug names
-  contextInfo.addDeviceExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);            // Enabling ability to present rendering
 
   // #VKRay: Activate the ray tracing extension
   VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
@@ -144,18 +122,8 @@ int main(int argc, char** argv)
   // Create example
   HelloVulkan helloVk;
 
-  // Window need to be opened to get the surface on which to draw
-  const VkSurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
-  vkctx.setGCTQueueWithPresent(surface);
-
-  helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice, vkctx.m_queueGCT.familyIndex);
-  helloVk.createSwapchain(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
-  helloVk.createDepthBuffer();
-  helloVk.createRenderPass();
-  helloVk.createFrameBuffers();
-
-  // Setup Imgui
-  helloVk.initGUI(0);  // Using sub-pass 0
+  // Surface, swapchain and ImGui of the window, or only the rendering size in headless mode
+  setupSampleApp(headless, vkctx, helloVk, window, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
   // Creation of the example
   nvmath::mat4f t = nvmath::translation_mat4(nvmath::vec3f{0, 0.0, 0});
@@ -177,27 +145,75 @@ int main(int argc, char** argv)
   // Need the Top level AS
   helloVk.updateDescriptorSet();
 
-  helloVk.createPostDescriptor();
-  helloVk.createPostPipeline();
-  helloVk.updatePostDescriptorSet();
+  // The post-process renders in the swapchain
+  if(!headless.enabled)
+  {
+    helloVk.createPostDescriptor();
+    helloVk.createPostPipeline();
+    helloVk.updatePostDescriptorSet();
+  }
 
 
   helloVk.createCompDescriptors();
   helloVk.updateCompDescriptors();
   helloVk.createCompPipelines();
+  helloVk.createDenoiser();
+  helloVk.updateDenoiserDescriptors();
 
 
   nvmath::vec4f clearColor = nvmath::vec4f(0, 0, 0, 0);
 
-  helloVk.setupGlfwCallbacks(window);
-  ImGui_ImplGlfw_InitForVulkan(window, true);
-
 
   AoControl aoControl;
+  aoControl.rtao_samples      = int(headless.benchmark.getParam("aoSamples", float(aoControl.rtao_samples)));
+  aoControl.temporal          = int(headless.benchmark.getParam("aoTemporal", float(aoControl.temporal)));
+  helloVk.m_aoHalfRes         = headless.benchmark.getParam("aoHalfRes", helloVk.m_aoHalfRes ? 1.f : 0.f) != 0.f;
+  helloVk.m_denoiseIterations = int(headless.benchmark.getParam("denoiseIterations", float(helloVk.m_denoiseIterations)));
 
 
+  // Headless: rendering the frames and saving the offscreen image with the AO, without UI
+  int result = 0;
+  if(headless.enabled)
+  {
+    auto renderFrame = [&](const VkCommandBuffer& cmdBuf, uint32_t /*frame*/) {
+      helloVk.m_profiler.beginFrame(cmdBuf);
+      helloVk.updateUniformBuffer(cmdBuf);
+
+      // Color, G-Buffer and depth attachments
+      std::array<VkClearValue, 3> clearValues{};
+      clearValues[0].color        = {{clearColor[0], clearColor[1], clearColor[2], clearColor[3]}};
+      clearValues[1].color        = {{0, 0, 0, 0}};
+      clearValues[2].depthStencil = {1.0f, 0};
+
+      VkRenderPassBeginInfo offscreenRenderPassBeginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+      offscreenRenderPassBeginInfo.clearValueCount = (uint32_t)clearValues.size();
+      offscreenRenderPassBeginInfo.pClearValues    = clearValues.data();
+      offscreenRenderPassBeginInfo.renderPass      = helloVk.m_offscreenRenderPass;
+      offscreenRenderPassBeginInfo.framebuffer     = helloVk.m_offscreenFramebuffer;
+      offscreenRenderPassBeginInfo.renderArea      = {{0, 0}, helloVk.getSize()};
+
+      vkCmdBeginRenderPass(cmdBuf, &offscreenRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+      helloVk.rasterize(cmdBuf);
+      vkCmdEndRenderPass(cmdBuf);
+      helloVk.runCompute(cmdBuf, aoControl);
+      helloVk.runDenoiser(cmdBuf);
+    };
+    // Same as the post-process, without the gamma as the EXR is linear: color * AO, denoised if enabled
+    auto composite = [&](std::vector<float>& rgba) {
+      const nvvk::Texture& aoImage = helloVk.m_denoiseIterations > 0 ? helloVk.m_aoDenoised : helloVk.m_aoBuffer;
+      std::vector<float>   ao;
+      readbackImage(helloVk, helloVk.m_alloc, aoImage.image, helloVk.getSize(), ao, 2);
+      for(size_t i = 0; i < ao.size() / 2; i++)
+        for(size_t c = 0; c < 4; c++)
+          rgba[i * 4 + c] *= ao[i * 2];
+    };
+    if(!renderHeadless(helloVk, helloVk.m_alloc, helloVk.m_offscreenColor.image, headless, renderFrame,
+                      &helloVk.m_profiler, composite))
+      result = 1;
+  }
+
   // Main loop
-  while(!glfwWindowShouldClose(window))
+  while(!headless.enabled && !glfwWindowShouldClose(window))
   {
     try
     {
@@ -225,9 +241,22 @@ int main(int argc, char** argv)
           changed |= ImGui::SliderFloat("Power", &aoControl.rtao_power, 1, 5);
           changed |= ImGui::InputInt("Max Samples", &aoControl.max_samples);
           changed |= ImGui::Checkbox("Distanced Based", (bool*)&aoControl.rtao_distance_based);
+          changed |= ImGui::Checkbox("Temporal Reprojection", (bool*)&aoControl.temporal);
+          if(aoControl.temporal)
+            changed |= ImGui::SliderInt("Max History", &aoControl.max_history, 1, 128);
+          changed |= ImGui::Checkbox("Half Resolution", &helloVk.m_aoHalfRes);
           if(changed)
             helloVk.resetFrame();
         }
+        if(ImGui::CollapsingHeader("Denoiser"))
+        {
+          // Filtering the AO buffer again at each frame, the accumulation is not reset
+          ImGui::SliderInt("Iterations", &helloVk.m_denoiseIterations, 0, 5);
+          ImGui::SliderFloat("AO Phi", &helloVk.m_pcDenoise.colorPhi, 0.01f, 2.f);
+          ImGui::SliderFloat("Normal Phi", &helloVk.m_pcDenoise.normalPhi, 0.01f, 2.f);
+          ImGui::SliderFloat("Position Phi", &helloVk.m_pcDenoise.positionPhi, 0.01f, 2.f);
+        }
+        helloVk.m_profiler.renderUI();
 
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGuiH::Control::Info("", "", "(F10) Toggle Pane", ImGuiH::Control::Flags::Disabled);
@@ -244,6 +273,7 @@ int main(int argc, char** argv)
       VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
       beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
       vkBeginCommandBuffer(cmdBuf, &beginInfo);
+      helloVk.m_profiler.beginFrame(cmdBuf);
 
       // Updating camera buffer
       helloVk.updateUniformBuffer(cmdBuf);
@@ -270,6 +300,7 @@ int main(int argc, char** argv)
           helloVk.rasterize(cmdBuf);
           vkCmdEndRenderPass(cmdBuf);
           helloVk.runCompute(cmdBuf, aoControl);
+          helloVk.runDenoiser(cmdBuf);
         }
       }
 
@@ -316,8 +347,7 @@ int main(int argc, char** argv)
   helloVk.destroy();
   vkctx.deinit();
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  destroySampleWindow(window);
 
-  return 0;
+  return result;
 }
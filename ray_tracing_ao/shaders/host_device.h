@@ -91,6 +91,15 @@ struct PushConstantRay
   int   lightType;
 };
 
+// Push constant structure for one iteration of the a-trous denoiser
+struct PushConstantDenoise
+{
+  int   stepWidth;    // Distance between the taps: 1, 2, 4, ...
+  float colorPhi;     // Edge-stopping on the filtered values, halved at each iteration
+  float normalPhi;    // Edge-stopping on the normals
+  float positionPhi;  // Edge-stopping on the positions
+};
+
 struct Vertex  // See ObjLoader, copy of VertexObj, could be compressed for device
 {
   vec3 pos;
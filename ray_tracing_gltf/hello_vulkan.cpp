@@ -357,6 +357,9 @@ void HelloVulkan::destroyResources()
   //#Post
   m_alloc.destroy(m_offscreenColor);
   m_alloc.destroy(m_offscreenDepth);
+  m_alloc.destroy(m_gBuffer);
+  m_alloc.destroy(m_denoised);
+  m_alloc.destroy(m_denoiseTemp);
   vkDestroyPipeline(m_device, m_postPipeline, nullptr);
   vkDestroyPipelineLayout(m_device, m_postPipelineLayout, nullptr);
   vkDestroyDescriptorPool(m_device, m_postDescPool, nullptr);
@@ -372,6 +375,11 @@ void HelloVulkan::destroyResources()
   vkDestroyDescriptorPool(m_device, m_rtDescPool, nullptr);
   vkDestroyDescriptorSetLayout(m_device, m_rtDescSetLayout, nullptr);
 
+  // #Denoiser
+  vkDestroyPipeline(m_device, m_denoisePipeline, nullptr);
+  vkDestroyPipelineLayout(m_device, m_denoisePipelineLayout, nullptr);
+  vkDestroyDescriptorPool(m_device, m_denoiseDescPool, nullptr);
+  vkDestroyDescriptorSetLayout(m_device, m_denoiseDescSetLayout, nullptr);
 
   m_alloc.deinit();
 }
@@ -422,6 +430,7 @@ void HelloVulkan::onResize(int /*w*/, int /*h*/)
   createOffscreenRender();
   updatePostDescriptorSet();
   updateRtDescriptorSet();
+  updateDenoiserDescriptors();
   resetFrame();
 }
 
@@ -438,6 +447,9 @@ void HelloVulkan::createOffscreenRender()
 {
   m_alloc.destroy(m_offscreenColor);
   m_alloc.destroy(m_offscreenDepth);
+  m_alloc.destroy(m_gBuffer);
+  m_alloc.destroy(m_denoised);
+  m_alloc.destroy(m_denoiseTemp);
 
   // Creating the color image
   {
@@ -453,6 +465,32 @@ void HelloVulkan::createOffscreenRender()
     m_offscreenColor.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
   }
 
+  // The first hits of the path tracer, guiding the denoiser, and the images written by the denoiser
+  {
+    auto gBufferInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+    nvvk::Image gBufferImage         = m_alloc.createImage(gBufferInfo);
+    m_gBuffer                        = m_alloc.createTexture(gBufferImage, nvvk::makeImageViewCreateInfo(gBufferImage.image, gBufferInfo));
+    m_gBuffer.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_gBuffer.image, "G-Buffer");
+
+    // Sampled by the post-process, and read back in headless mode
+    auto denoisedInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenColorFormat,
+                                                    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT
+                                                        | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    nvvk::Image           denoisedImage = m_alloc.createImage(denoisedInfo);
+    VkImageViewCreateInfo ivInfo        = nvvk::makeImageViewCreateInfo(denoisedImage.image, denoisedInfo);
+    VkSamplerCreateInfo   sampler{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    m_denoised                        = m_alloc.createTexture(denoisedImage, ivInfo, sampler);
+    m_denoised.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_denoised.image, "denoised");
+
+    auto        tempInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenColorFormat, VK_IMAGE_USAGE_STORAGE_BIT);
+    nvvk::Image tempImage                = m_alloc.createImage(tempInfo);
+    m_denoiseTemp                        = m_alloc.createTexture(tempImage, nvvk::makeImageViewCreateInfo(tempImage.image, tempInfo));
+    m_denoiseTemp.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_denoiseTemp.image, "denoise temp");
+  }
+
   // Creating the depth buffer
   auto depthCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
   {
@@ -473,6 +511,9 @@ void HelloVulkan::createOffscreenRender()
     nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
     auto              cmdBuf = genCmdBuf.createCommandBuffer();
     nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_gBuffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_denoised.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_denoiseTemp.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
     nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenDepth.image, VK_IMAGE_LAYOUT_UNDEFINED,
                                 VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
 
@@ -534,9 +575,10 @@ void HelloVulkan::createPostPipeline()
 void HelloVulkan::createPostDescriptor()
 {
   m_postDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
-  m_postDescSetLayout = m_postDescSetLayoutBind.createLayout(m_device);
-  m_postDescPool      = m_postDescSetLayoutBind.createPool(m_device);
-  m_postDescSet       = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
+  m_postDescSetLayout   = m_postDescSetLayoutBind.createLayout(m_device);
+  m_postDescPool        = m_postDescSetLayoutBind.createPool(m_device, 2);
+  m_postDescSet         = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
+  m_postDenoisedDescSet = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
 }
 
 
@@ -545,14 +587,16 @@ void HelloVulkan::createPostDescriptor()
 //
 void HelloVulkan::updatePostDescriptorSet()
 {
-  VkWriteDescriptorSet writeDescriptorSets = m_postDescSetLayoutBind.makeWrite(m_postDescSet, 0, &m_offscreenColor.descriptor);
-  vkUpdateDescriptorSets(m_device, 1, &writeDescriptorSets, 0, nullptr);
+  std::vector<VkWriteDescriptorSet> writes;
+  writes.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDescSet, 0, &m_offscreenColor.descriptor));
+  writes.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDenoisedDescSet, 0, &m_denoised.descriptor));
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Draw a full screen quad with the attached image
+// Draw a full screen quad with the attached image, or with the output of the denoiser
 //
-void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
+void HelloVulkan::drawPost(VkCommandBuffer cmdBuf, bool denoised)
 {
   m_debug.beginLabel(cmdBuf, "Post");
 
@@ -561,7 +605,8 @@ void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
   auto aspectRatio = static_cast<float>(m_size.width) / static_cast<float>(m_size.height);
   vkCmdPushConstants(cmdBuf, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &aspectRatio);
   vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
-  vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &m_postDescSet, 0, nullptr);
+  VkDescriptorSet postDescSet = denoised ? m_postDenoisedDescSet : m_postDescSet;
+  vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &postDescSet, 0, nullptr);
   vkCmdDraw(cmdBuf, 3, 1, 0, 0);
 
   m_debug.endLabel(cmdBuf);
@@ -677,6 +722,8 @@ void HelloVulkan::createRtDescriptorSet()
                                    VK_SHADER_STAGE_RAYGEN_BIT_KHR);  // Output image
   m_rtDescSetLayoutBind.addBinding(RtxBindings::ePrimLookup, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                                    VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR);  // Primitive info
+  m_rtDescSetLayoutBind.addBinding(RtxBindings::eGBuffer, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+                                   VK_SHADER_STAGE_RAYGEN_BIT_KHR);  // First hits
 
   m_rtDescPool      = m_rtDescSetLayoutBind.createPool(m_device);
   m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
@@ -699,6 +746,7 @@ void HelloVulkan::createRtDescriptorSet()
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eTlas, &descASInfo));
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::ePrimLookup, &primitiveInfoDesc));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eGBuffer, &m_gBuffer.descriptor));
   vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
@@ -709,10 +757,12 @@ void HelloVulkan::createRtDescriptorSet()
 //
 void HelloVulkan::updateRtDescriptorSet()
 {
-  // (1) Output buffer
-  VkDescriptorImageInfo imageInfo{{}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
-  VkWriteDescriptorSet  wds = m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo);
-  vkUpdateDescriptorSets(m_device, 1, &wds, 0, nullptr);
+  // (1) Output buffer, (2) first hits
+  VkDescriptorImageInfo             imageInfo{{}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
+  std::vector<VkWriteDescriptorSet> writes;
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eGBuffer, &m_gBuffer.descriptor));
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
@@ -858,6 +908,100 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& c
   m_debug.endLabel(cmdBuf);
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Denoiser
+//////////////////////////////////////////////////////////////////////////
+
+//--------------------------------------------------------------------------------------------------
+// One compute pipeline, and a descriptor set for each pair of images it reads and writes
+//
+void HelloVulkan::createDenoiser()
+{
+  m_denoiseDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] G-Buffer
+  m_denoiseDescSetLayoutBind.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [in] color
+  m_denoiseDescSetLayoutBind.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);  // [out] color
+
+  m_denoiseDescSetLayout = m_denoiseDescSetLayoutBind.createLayout(m_device);
+  m_denoiseDescPool      = m_denoiseDescSetLayoutBind.createPool(m_device, static_cast<uint32_t>(m_denoiseDescSets.size()));
+  for(auto& descSet : m_denoiseDescSets)
+    descSet = nvvk::allocateDescriptorSet(m_device, m_denoiseDescPool, m_denoiseDescSetLayout);
+
+  VkPushConstantRange        pushConstants = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise)};
+  VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  plCreateInfo.setLayoutCount         = 1;
+  plCreateInfo.pSetLayouts            = &m_denoiseDescSetLayout;
+  plCreateInfo.pushConstantRangeCount = 1;
+  plCreateInfo.pPushConstantRanges    = &pushConstants;
+  vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_denoisePipelineLayout);
+
+  VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+  cpCreateInfo.layout = m_denoisePipelineLayout;
+  cpCreateInfo.stage  = nvvk::createShaderStageInfo(m_device, nvh::loadFile("spv/atrous.comp.spv", true, defaultSearchPaths, true),
+                                                   VK_SHADER_STAGE_COMPUTE_BIT);
+  vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_denoisePipeline);
+  vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The iterations alternate between m_denoiseTemp and m_denoised, the first one reading the path traced image
+//
+void HelloVulkan::updateDenoiserDescriptors()
+{
+  const std::array<const nvvk::Texture*, 4> inputs{&m_offscreenColor, &m_offscreenColor, &m_denoiseTemp, &m_denoised};
+  const std::array<const nvvk::Texture*, 4> outputs{&m_denoised, &m_denoiseTemp, &m_denoised, &m_denoiseTemp};
+
+  std::vector<VkWriteDescriptorSet> writes;
+  for(size_t i = 0; i < m_denoiseDescSets.size(); i++)
+  {
+    writes.emplace_back(m_denoiseDescSetLayoutBind.makeWrite(m_denoiseDescSets[i], 0, &m_gBuffer.descriptor));
+    writes.emplace_back(m_denoiseDescSetLayoutBind.makeWrite(m_denoiseDescSets[i], 1, &inputs[i]->descriptor));
+    writes.emplace_back(m_denoiseDescSetLayoutBind.makeWrite(m_denoiseDescSets[i], 2, &outputs[i]->descriptor));
+  }
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Filtering the accumulated path tracing into m_denoised, with m_denoiseIterations passes of the a-trous filter
+//
+#define GROUP_SIZE 16  // Same group size as in compute shader
+void HelloVulkan::runDenoiser(const VkCommandBuffer& cmdBuf)
+{
+  if(m_denoiseIterations <= 0)
+    return;
+
+  m_debug.beginLabel(cmdBuf, "Denoiser");
+
+  // The path tracer, and the reads of the post-process of the previous frame, are done with the images
+  VkMemoryBarrier memBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  memBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  memBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
+  PushConstantDenoise pcDenoise = m_pcDenoise;
+  for(int i = 0; i < m_denoiseIterations; i++)
+  {
+    // Writing m_denoised when the number of iterations left is odd, so that the last one ends there
+    const bool toDenoised = (m_denoiseIterations - i) % 2 == 1;
+    const int  descSetId  = (i == 0 ? 0 : 2) + (toDenoised ? 0 : 1);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipelineLayout, 0, 1,
+                            &m_denoiseDescSets[descSetId], 0, nullptr);
+
+    pcDenoise.stepWidth = 1 << i;
+    pcDenoise.colorPhi  = m_pcDenoise.colorPhi / static_cast<float>(1 << i);
+    vkCmdPushConstants(cmdBuf, m_denoisePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise), &pcDenoise);
+    vkCmdDispatch(cmdBuf, (m_size.width + (GROUP_SIZE - 1)) / GROUP_SIZE, (m_size.height + (GROUP_SIZE - 1)) / GROUP_SIZE, 1);
+
+    // Next iteration, or the post-process
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1,
+                         &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  m_debug.endLabel(cmdBuf);
+}
+
 //--------------------------------------------------------------------------------------------------
 // If the camera matrix has changed, resets the frame.
 // otherwise, increments frame.
@@ -27,6 +27,8 @@
 #include "nvvk/memallocator_dma_vk.hpp"
 #include "nvvk/resourceallocator_vk.hpp"
 
+#include <array>
+
 // #VKRay
 #include "nvh/gltfscene.hpp"
 #include "nvvk/raytraceKHR_vk.hpp"
@@ -51,6 +53,7 @@ public:
   void createTextureImages(const VkCommandBuffer& cmdBuf, tinygltf::Model& gltfModel);
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
@@ -94,7 +97,7 @@ public:
   void createPostPipeline();
   void createPostDescriptor();
   void updatePostDescriptorSet();
-  void drawPost(VkCommandBuffer cmdBuf);
+  void drawPost(VkCommandBuffer cmdBuf, bool denoised);
 
   nvvk::DescriptorSetBindings m_postDescSetLayoutBind;
   VkDescriptorPool            m_postDescPool{VK_NULL_HANDLE};
@@ -106,6 +109,7 @@ public:
   VkFramebuffer               m_offscreenFramebuffer{VK_NULL_HANDLE};
   nvvk::Texture               m_offscreenColor;
   nvvk::Texture               m_offscreenDepth;
+  nvvk::Texture               m_gBuffer;  // First hit of the path tracer (rgba32f): position(xyz) / normal(w-compressed)
   VkFormat                    m_offscreenColorFormat{VK_FORMAT_R32G32B32A32_SFLOAT};
   VkFormat                    m_offscreenDepthFormat{VK_FORMAT_X8_D24_UNORM_PACK32};
 
@@ -133,4 +137,21 @@ public:
   nvvk::SBTWrapper                                  m_sbtWrapper;
 
   PushConstantRay m_pcRay{};
+
+  // #Denoiser - a-trous wavelet filter of the path traced image, guided by the first hits
+  void createDenoiser();
+  void updateDenoiserDescriptors();
+  void runDenoiser(const VkCommandBuffer& cmdBuf);
+
+  nvvk::Texture                  m_denoised;     // Result of the last iteration, displayed by the post-process
+  nvvk::Texture                  m_denoiseTemp;  // Ping-pong with m_denoised
+  nvvk::DescriptorSetBindings    m_denoiseDescSetLayoutBind;
+  VkDescriptorPool               m_denoiseDescPool{VK_NULL_HANDLE};
+  VkDescriptorSetLayout          m_denoiseDescSetLayout{VK_NULL_HANDLE};
+  std::array<VkDescriptorSet, 4> m_denoiseDescSets{};  // color->denoised, color->temp, temp->denoised, denoised->temp
+  VkPipeline                     m_denoisePipeline{VK_NULL_HANDLE};
+  VkPipelineLayout               m_denoisePipelineLayout{VK_NULL_HANDLE};
+  VkDescriptorSet                m_postDenoisedDescSet{VK_NULL_HANDLE};  // Post-process reading m_denoised
+  int                            m_denoiseIterations{0};                 // 0: no filtering
+  PushConstantDenoise            m_pcDenoise{1, 1.0f, 0.5f, 0.5f};
 };
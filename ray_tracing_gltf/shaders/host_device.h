@@ -50,7 +50,8 @@ END_BINDING();
 START_BINDING(RtxBindings)
   eTlas       = 0,  // Top-level acceleration structure
   eOutImage   = 1,  // Ray tracer output image
-  ePrimLookup = 2   // Lookup of objects
+  ePrimLookup = 2,  // Lookup of objects
+  eGBuffer    = 3   // First hit of the path tracer: position, compressed normal
 END_BINDING();
 // clang-format on
 
@@ -95,6 +96,15 @@ struct PushConstantRay
   int   frame;
 };
 
+// Push constant structure for one iteration of the a-trous denoiser
+struct PushConstantDenoise
+{
+  int   stepWidth;    // Distance between the taps: 1, 2, 4, ...
+  float colorPhi;     // Edge-stopping on the filtered values, halved at each iteration
+  float normalPhi;    // Edge-stopping on the normals
+  float positionPhi;  // Edge-stopping on the positions
+};
+
 // Structure used for retrieving the primitive information in the closest hit
 struct PrimMeshInfo
 {
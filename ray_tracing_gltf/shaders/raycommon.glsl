@@ -25,4 +25,9 @@ struct hitPayload
   vec3 rayOrigin;
   vec3 rayDirection;
   vec3 weight;
+  vec3 normal;  // Shading normal of the hit, used by the first hit of the path tracer
 };
+
+
+// Compression of the normals stored in the G-Buffer
+#include "../../common/shaders/unit_vector.glsl"
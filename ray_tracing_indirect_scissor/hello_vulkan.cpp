@@ -18,6 +18,8 @@
  */
 
 
+#include <algorithm>
+#include <array>
 #include <sstream>
 
 
@@ -49,6 +51,7 @@ void HelloVulkan::setup(const VkInstance& instance, const VkDevice& device, cons
   AppBaseVk::setup(instance, device, physicalDevice, queueFamily);
   m_alloc.init(instance, device, physicalDevice);
   m_debug.setup(m_device);
+  m_profiler.init(m_device, physicalDevice, queueFamily);
   m_offscreenDepthFormat = nvvk::findDepthFormat(physicalDevice);
 }
 
@@ -401,11 +404,17 @@ void HelloVulkan::destroyResources()
   vkDestroyDescriptorPool(m_device, m_lanternIndirectDescPool, nullptr);
   vkDestroyDescriptorSetLayout(m_device, m_lanternIndirectDescSetLayout, nullptr);
   vkDestroyPipeline(m_device, m_lanternIndirectCompPipeline, nullptr);
+  vkDestroyPipeline(m_device, m_lanternTileCompPipeline, nullptr);
   vkDestroyPipelineLayout(m_device, m_lanternIndirectCompPipelineLayout, nullptr);
   m_alloc.destroy(m_lanternIndirectBuffer);
+  m_alloc.destroy(m_lanternTileBuffer);
+  m_alloc.destroy(m_lanternVisibleBuffer);
+  m_alloc.unmap(m_lanternVisibleReadBuffer);
+  m_alloc.destroy(m_lanternVisibleReadBuffer);
   m_alloc.destroy(m_lanternVertexBuffer);
   m_alloc.destroy(m_lanternIndexBuffer);
 
+  m_profiler.deinit();
   m_alloc.deinit();
 }
 
@@ -417,6 +426,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
   VkDeviceSize offset{0};
 
   m_debug.beginLabel(cmdBuf, "Rasterize");
+  m_profiler.beginSection("Rasterize", cmdBuf);
 
   // Dynamic Viewport
   setViewport(cmdBuf);
@@ -438,6 +448,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
     vkCmdBindIndexBuffer(cmdBuf, model.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
     vkCmdDrawIndexed(cmdBuf, model.nbIndices, 1, 0, 0, 0);
   }
+  m_profiler.endSection("Rasterize", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
@@ -447,6 +458,7 @@ void HelloVulkan::rasterize(const VkCommandBuffer& cmdBuf)
 void HelloVulkan::onResize(int /*w*/, int /*h*/)
 {
   createOffscreenRender();
+  createLanternTileBuffer();
   updatePostDescriptorSet();
   updateRtDescriptorSet();
 }
@@ -581,6 +593,7 @@ void HelloVulkan::updatePostDescriptorSet()
 void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
 {
   m_debug.beginLabel(cmdBuf, "Post");
+  m_profiler.beginSection("Post", cmdBuf);
 
   setViewport(cmdBuf);
 
@@ -590,6 +603,7 @@ void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
   vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &m_postDescSet, 0, nullptr);
   vkCmdDraw(cmdBuf, 3, 1, 0, 0);
 
+  m_profiler.endSection("Post", cmdBuf);
   m_debug.endLabel(cmdBuf);
 }
 
@@ -862,7 +876,8 @@ void HelloVulkan::createTopLevelAS()
 }
 
 //--------------------------------------------------------------------------------------------------
-// This descriptor set holds the Acceleration structure, output image, and lanterns array buffer.
+// This descriptor set holds the Acceleration structure, output image, lanterns array buffer
+// and lantern tiles buffer.
 //
 void HelloVulkan::createRtDescriptorSet()
 {
@@ -875,7 +890,10 @@ void HelloVulkan::createRtDescriptorSet()
   // Lantern buffer
   m_rtDescSetLayoutBind.addBinding(eLanterns, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                                    VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+  // Lanterns of each screen tile
+  m_rtDescSetLayoutBind.addBinding(eLanternTiles, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
   assert(m_lanternCount > 0);
+  assert(m_lanternTileBuffer.buffer);
 
   m_rtDescPool      = m_rtDescSetLayoutBind.createPool(m_device);
   m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
@@ -893,25 +911,33 @@ void HelloVulkan::createRtDescriptorSet()
   descASInfo.pAccelerationStructures    = &tlas;
   VkDescriptorImageInfo imageInfo{{}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
   VkDescriptorBufferInfo lanternBufferInfo{m_lanternIndirectBuffer.buffer, 0, m_lanternCount * sizeof(LanternIndirectEntry)};
+  VkDescriptorBufferInfo tileBufferInfo{m_lanternTileBuffer.buffer, 0, VK_WHOLE_SIZE};
 
   std::vector<VkWriteDescriptorSet> writes;
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eTlas, &descASInfo));
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, eLanterns, &lanternBufferInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, eLanternTiles, &tileBufferInfo));
   vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
 //--------------------------------------------------------------------------------------------------
-// Writes the output image to the descriptor set
+// Writes the output image and the lantern tiles to the descriptor sets
 // - Required when changing resolution
 //
 void HelloVulkan::updateRtDescriptorSet()
 {
   // (1) Output buffer
   VkDescriptorImageInfo imageInfo{{}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
-  VkWriteDescriptorSet  wds = m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo);
-  vkUpdateDescriptorSets(m_device, 1, &wds, 0, nullptr);
+  // (2) Lantern tiles, in the ray tracing and the compute sets
+  VkDescriptorBufferInfo tileBufferInfo{m_lanternTileBuffer.buffer, 0, VK_WHOLE_SIZE};
+
+  std::vector<VkWriteDescriptorSet> writes;
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, eLanternTiles, &tileBufferInfo));
+  writes.emplace_back(m_lanternIndirectDescSetLayoutBind.makeWrite(m_lanternIndirectDescSet, 1, &tileBufferInfo));
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
@@ -1187,11 +1213,16 @@ void HelloVulkan::createRtShaderBindingTable()
 
 
 //--------------------------------------------------------------------------------------------------
-// The compute shader just needs read/write access to the buffer of LanternIndirectEntry.
+// The compute shader needs read/write access to the buffer of LanternIndirectEntry
+// and to the list of visible lanterns, and write access to the lantern tiles when binning.
 void HelloVulkan::createLanternIndirectDescriptorSet()
 {
   // Lantern buffer (binding = 0)
   m_lanternIndirectDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  // Lantern tiles (binding = 1)
+  m_lanternIndirectDescSetLayoutBind.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  // Visible lanterns (binding = 2)
+  m_lanternIndirectDescSetLayoutBind.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
 
   m_lanternIndirectDescPool      = m_lanternIndirectDescSetLayoutBind.createPool(m_device);
   m_lanternIndirectDescSetLayout = m_lanternIndirectDescSetLayoutBind.createLayout(m_device);
@@ -1204,15 +1235,21 @@ void HelloVulkan::createLanternIndirectDescriptorSet()
 
 
   assert(m_lanternIndirectBuffer.buffer);
+  assert(m_lanternTileBuffer.buffer);
   VkDescriptorBufferInfo lanternBufferInfo{m_lanternIndirectBuffer.buffer, 0, m_lanternCount * sizeof(LanternIndirectEntry)};
+  VkDescriptorBufferInfo tileBufferInfo{m_lanternTileBuffer.buffer, 0, VK_WHOLE_SIZE};
+  VkDescriptorBufferInfo visibleBufferInfo{m_lanternVisibleBuffer.buffer, 0, VK_WHOLE_SIZE};
 
   std::vector<VkWriteDescriptorSet> writes;
   writes.emplace_back(m_lanternIndirectDescSetLayoutBind.makeWrite(m_lanternIndirectDescSet, 0, &lanternBufferInfo));
+  writes.emplace_back(m_lanternIndirectDescSetLayoutBind.makeWrite(m_lanternIndirectDescSet, 1, &tileBufferInfo));
+  writes.emplace_back(m_lanternIndirectDescSetLayoutBind.makeWrite(m_lanternIndirectDescSet, 2, &visibleBufferInfo));
   vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 // Create compute pipeline used to fill m_lanternIndirectBuffer with parameters
-// for dispatching the correct number of ray traces.
+// for dispatching the correct number of ray traces, and its tile binning variant
+// filling m_lanternTileBuffer.
 void HelloVulkan::createLanternIndirectCompPipeline()
 {
   // Compile compute shader and package as stage.
@@ -1240,6 +1277,13 @@ void HelloVulkan::createLanternIndirectCompPipeline()
   pipelineInfo.layout = m_lanternIndirectCompPipelineLayout;
   vkCreateComputePipelines(m_device, {}, 1, &pipelineInfo, nullptr, &m_lanternIndirectCompPipeline);
 
+  // Tile binning: same shader and layout, specialized with BIN_TILES = 1.
+  int32_t                  binTiles = 1;
+  VkSpecializationMapEntry specEntry{0, 0, sizeof(binTiles)};
+  VkSpecializationInfo     specInfo{1, &specEntry, sizeof(binTiles), &binTiles};
+  pipelineInfo.stage.pSpecializationInfo = &specInfo;
+  vkCreateComputePipelines(m_device, {}, 1, &pipelineInfo, nullptr, &m_lanternTileCompPipeline);
+
   vkDestroyShaderModule(m_device, computeShader, nullptr);
 }
 
@@ -1269,6 +1313,84 @@ void HelloVulkan::createLanternIndirectBuffer()
   vkCmdUpdateBuffer(cmdBuf, m_lanternIndirectBuffer.buffer, 0, entries.size() * sizeof entries[0], entries.data());
 
   cmdBufGet.submitAndWait(cmdBuf);
+
+  // Visible lanterns: count, then up to m_lanternCount indices.
+  m_lanternVisibleBuffer = m_alloc.createBuffer((m_lanternCount + 1) * sizeof(uint32_t),
+                                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                                                    | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  // The list of a frame is read when its slot comes back, after the frame has been waited for.
+  // Without swapchain (headless), each frame is waited for before the next one is recorded.
+  m_lanternVisibleSlots      = m_swapChain.getImageCount() + 1;
+  m_lanternVisibleReadBuffer = m_alloc.createBuffer(m_lanternVisibleSlots * (m_lanternCount + 1) * sizeof(uint32_t),
+                                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_lanternVisibleReadback = static_cast<uint32_t*>(m_alloc.map(m_lanternVisibleReadBuffer));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Lanterns given a lantern pass this frame. The slot about to be reused holds the visible list
+// of the frame recorded m_lanternVisibleSlots frames ago, which has completed.
+//
+void HelloVulkan::updateVisibleLanterns()
+{
+  m_lanternPasses.clear();
+  if(!m_skipHiddenLanterns || m_lanternVisibleFrame < m_lanternVisibleSlots)
+  {
+    for(uint32_t i = 0; i < m_lanternCount; ++i)
+      m_lanternPasses.push_back(i);
+    return;
+  }
+
+  const uint32_t* visible = m_lanternVisibleReadback + (m_lanternVisibleFrame % m_lanternVisibleSlots) * (m_lanternCount + 1);
+  const uint32_t count    = std::min(visible[0], static_cast<uint32_t>(m_lanternCount));
+  m_lanternPasses.assign(visible + 1, visible + 1 + count);
+  // Appended in any order by the compute shader, the passes keep the lantern order.
+  std::sort(m_lanternPasses.begin(), m_lanternPasses.end());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Copies the visible list of this frame in its readback slot, read by updateVisibleLanterns
+// m_lanternVisibleSlots frames later.
+//
+void HelloVulkan::cmdReadVisibleLanterns(const VkCommandBuffer& cmdBuf)
+{
+  const uint32_t slot = m_lanternVisibleFrame % m_lanternVisibleSlots;
+  m_lanternVisibleFrame++;
+
+  const VkDeviceSize listSize = (m_lanternCount + 1) * sizeof(uint32_t);
+  VkBufferCopy       region{0, slot * listSize, listSize};
+  vkCmdCopyBuffer(cmdBuf, m_lanternVisibleBuffer.buffer, m_lanternVisibleReadBuffer.buffer, 1, &region);
+
+  VkBufferMemoryBarrier readBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+  readBarrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+  readBarrier.dstAccessMask       = VK_ACCESS_HOST_READ_BIT;
+  readBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  readBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  readBarrier.buffer              = m_lanternVisibleReadBuffer.buffer;
+  readBarrier.offset              = slot * listSize;
+  readBarrier.size                = listSize;
+  vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VkDependencyFlags(0), 0,
+                       nullptr, 1, &readBarrier, 0, nullptr);
+}
+
+// Number of LANTERN_TILE_SIZE^2 pixel tiles covering the output image.
+uint32_t HelloVulkan::getLanternTileCount() const
+{
+  uint32_t tilesX = (m_size.width + LANTERN_TILE_SIZE - 1) / LANTERN_TILE_SIZE;
+  uint32_t tilesY = (m_size.height + LANTERN_TILE_SIZE - 1) / LANTERN_TILE_SIZE;
+  return tilesX * tilesY;
+}
+
+// (Re)allocate the lantern tiles buffer for the current size of the output image.
+// Its content is written each frame by the tile binning compute shader.
+void HelloVulkan::createLanternTileBuffer()
+{
+  m_alloc.destroy(m_lanternTileBuffer);
+  m_lanternTileBuffer = m_alloc.createBuffer(VkDeviceSize(getLanternTileCount()) * LANTERN_TILE_STRIDE * sizeof(uint32_t),
+                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  m_debug.setObjectName(m_lanternTileBuffer.buffer, "lanternTiles");
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1283,28 +1405,61 @@ void HelloVulkan::createLanternIndirectBuffer()
 // a compute shader to calculate a bounding scissor rectangle for each lantern's light
 // effect. This is stored in m_lanternIndirectBuffer. Then an indirect trace rays command
 // is run for every lantern within its scissor rectangle. The lanterns' light
-// contribution is additively blended into the output image.
+// contribution is additively blended into the output image. The compute shader also
+// lists the lanterns with a non-empty rectangle, and the passes of the lanterns off
+// screen in the list read back from a previous frame are skipped.
+//
+// With m_lanternTiles, a second compute dispatch bins the scissor rectangles into
+// screen tiles instead, and the first pass adds the light of the lanterns of each
+// tile: a single trace, whatever the number of lanterns.
 void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& clearColor)
 {
   // Before tracing rays, we need to dispatch the compute shaders that
   // fill in the ray trace indirect parameters for each lantern pass.
 
+  // Lanterns given a pass, from the oldest visible list read back.
+  updateVisibleLanterns();
+
   // First, barrier before, ensure writes aren't visible to previous frame.
-  VkBufferMemoryBarrier bufferBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-  bufferBarrier.srcAccessMask       = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-  bufferBarrier.dstAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
-  bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  bufferBarrier.buffer              = m_lanternIndirectBuffer.buffer;
-  bufferBarrier.offset              = 0;
-  bufferBarrier.size                = m_lanternCount * sizeof m_lanterns[0];
+  // The previous frame also read the lanterns and the tiles in the ray tracing shaders,
+  // and copied the visible list.
+  std::array<VkBufferMemoryBarrier, 3> bufferBarriers{};
+  for(VkBufferMemoryBarrier& barrier : bufferBarriers)
+  {
+    barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask       = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask       = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.offset              = 0;
+  }
+  VkBufferMemoryBarrier& bufferBarrier  = bufferBarriers[0];
+  VkBufferMemoryBarrier& visibleBarrier = bufferBarriers[1];
+  bufferBarrier.buffer                  = m_lanternIndirectBuffer.buffer;
+  bufferBarrier.size                    = m_lanternCount * sizeof m_lanterns[0];
+  visibleBarrier.buffer                 = m_lanternVisibleBuffer.buffer;
+  visibleBarrier.size                   = VK_WHOLE_SIZE;
+  bufferBarriers[2].buffer              = m_lanternTileBuffer.buffer;
+  bufferBarriers[2].size                = VK_WHOLE_SIZE;
   vkCmdPipelineBarrier(cmdBuf,
-                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,   //
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                           | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,  //
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,        //
+                       VkDependencyFlags(0),                                                         //
+                       0, nullptr, uint32_t(bufferBarriers.size()), bufferBarriers.data(), 0, nullptr);
+
+  // Empty visible list, the scissor shader appends to it.
+  vkCmdFillBuffer(cmdBuf, m_lanternVisibleBuffer.buffer, 0, sizeof(uint32_t), 0);
+  visibleBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  visibleBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmdBuf,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,        //
                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,  //
                        VkDependencyFlags(0),                  //
-                       0, nullptr, 1, &bufferBarrier, 0, nullptr);
+                       0, nullptr, 1, &visibleBarrier, 0, nullptr);
 
   // Bind compute shader, update push constant and descriptors, dispatch compute.
+  m_profiler.beginSection("Lantern scissor", cmdBuf);
   vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_lanternIndirectCompPipeline);
   nvmath::mat4f view                          = getViewMatrix();
   m_lanternIndirectPushConstants.viewRowX     = view.row(0);
@@ -1319,16 +1474,44 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& c
                      sizeof(LanternIndirectPushConstants), &m_lanternIndirectPushConstants);
   vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_lanternIndirectCompPipelineLayout, 0, 1,
                           &m_lanternIndirectDescSet, 0, nullptr);
-  vkCmdDispatch(cmdBuf, 1, 1, 1);
+  // One thread per lantern, LOCAL_SIZE = 128 in lanternIndirect.comp
+  vkCmdDispatch(cmdBuf, uint32_t((m_lanternCount + 127) / 128), 1, 1);
+  m_profiler.endSection("Lantern scissor", cmdBuf);
+
+  if(m_lanternTiles)
+  {
+    // Scissor rectangles written before binning them, one thread per tile.
+    for(int i = 0; i < 2; ++i)
+    {
+      bufferBarriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      bufferBarriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    vkCmdPipelineBarrier(cmdBuf,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,  //
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,  //
+                         VkDependencyFlags(0),                  //
+                         0, nullptr, 2, bufferBarriers.data(), 0, nullptr);
+
+    m_profiler.beginSection("Lantern tiles", cmdBuf);
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_lanternTileCompPipeline);
+    vkCmdDispatch(cmdBuf, (getLanternTileCount() + 127) / 128, 1, 1);
+    m_profiler.endSection("Lantern tiles", cmdBuf);
+  }
 
-  // Ensure compute results are visible when doing indirect ray trace.
-  bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-  bufferBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  // Ensure compute results are visible when doing indirect ray trace, to the ray tracing
+  // shaders, and to the copy of the visible list.
+  for(VkBufferMemoryBarrier& barrier : bufferBarriers)
+  {
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  }
   vkCmdPipelineBarrier(cmdBuf,
                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,  //
-                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,   //
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                           | VK_PIPELINE_STAGE_TRANSFER_BIT,  //
                        VkDependencyFlags(0),                  //
-                       0, nullptr, 1, &bufferBarrier, 0, nullptr);
+                       0, nullptr, uint32_t(bufferBarriers.size()), bufferBarriers.data(), 0, nullptr);
+  cmdReadVisibleLanterns(cmdBuf);
 
 
   // Now move on to the actual ray tracing.
@@ -1343,6 +1526,7 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& c
   m_pcRay.screenX           = m_size.width;
   m_pcRay.screenY           = m_size.height;
   m_pcRay.lanternDebug      = m_lanternDebug;
+  m_pcRay.lanternTiles      = m_lanternTiles;
 
   std::vector<VkDescriptorSet> descSets{m_rtDescSet, m_descSet};
   vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
@@ -1353,12 +1537,23 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& c
                      0, sizeof(PushConstantRay), &m_pcRay);
 
 
+  m_profiler.beginSection("Ray trace", cmdBuf);
   vkCmdTraceRaysKHR(cmdBuf, &m_rgenRegion, &m_missRegion, &m_hitRegion, &m_callRegion, m_size.width, m_size.height, 1);
+  m_profiler.endSection("Ray trace", cmdBuf);
 
+  // The lanterns were already added by the first pass.
+  if(m_lanternTiles)
+  {
+    m_debug.endLabel(cmdBuf);
+    return;
+  }
 
   // Lantern passes, ensure previous pass completed, then add light contribution from each lantern.
-  for(int i = 0; i < static_cast<int>(m_lanternCount); ++i)
+  m_profiler.beginSection("Lantern passes", cmdBuf);
+  for(uint32_t lantern : m_lanternPasses)
   {
+    const int i = static_cast<int>(lantern);
+
     // Barrier to ensure previous pass finished.
     VkImage                 offscreenImage{m_offscreenColor.image};
     VkImageSubresourceRange colorRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
@@ -1390,6 +1585,7 @@ void HelloVulkan::raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& c
     // Execute lantern pass.
     vkCmdTraceRaysIndirectKHR(cmdBuf, &m_rgenRegion, &m_missRegion, &m_hitRegion, &m_callRegion, indirectDeviceAddress);
   }
+  m_profiler.endSection("Lantern passes", cmdBuf);
 
   m_debug.endLabel(cmdBuf);
 }
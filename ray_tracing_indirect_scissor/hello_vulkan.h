@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "gpu_profiler.h"
 #include "nvvk/appbase_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
@@ -60,6 +61,7 @@ public:
 
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
@@ -139,6 +141,7 @@ public:
 
   nvvk::ResourceAllocatorDma m_alloc;  // Allocator for buffer, images, acceleration structures
   nvvk::DebugUtil            m_debug;  // Utility to name objects
+  GpuProfiler                m_profiler;  // GPU time of the passes
 
 
   // #Post - Draw the rendered image on a quad using a tonemapper
@@ -179,6 +182,10 @@ public:
   void createLanternIndirectCompPipeline();
   void createRtShaderBindingTable();
   void createLanternIndirectBuffer();
+  void createLanternTileBuffer();
+  uint32_t getLanternTileCount() const;
+  void updateVisibleLanterns();
+  void cmdReadVisibleLanterns(const VkCommandBuffer& cmdBuf);
 
   void raytrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& clearColor);
 
@@ -206,6 +213,7 @@ public:
   VkDescriptorSet                                   m_lanternIndirectDescSet;
   VkPipelineLayout                                  m_lanternIndirectCompPipelineLayout;
   VkPipeline                                        m_lanternIndirectCompPipeline;
+  VkPipeline                                        m_lanternTileCompPipeline;  // Same shader, BIN_TILES = 1
 
   nvvk::Buffer                    m_rtSBTBuffer;
   VkStridedDeviceAddressRegionKHR m_rgenRegion{};
@@ -219,6 +227,21 @@ public:
   VkDeviceSize m_lanternCount = 0;  // Set to actual lantern count after TLAS build, as
                                     // that is the point no more lanterns may be added.
 
+  // Lanterns with a non-empty scissor rectangle, written each frame by the compute
+  // shader: count, then the lantern indices in any order.
+  nvvk::Buffer m_lanternVisibleBuffer;
+  // Host copies of the visible list, one slot per frame in flight, and the lanterns
+  // given a pass (all of them until the first copy comes back, or if not skipping).
+  nvvk::Buffer          m_lanternVisibleReadBuffer;
+  uint32_t*             m_lanternVisibleReadback{nullptr};
+  uint32_t              m_lanternVisibleSlots{1};
+  uint64_t              m_lanternVisibleFrame{0};
+  std::vector<uint32_t> m_lanternPasses;
+
+  // LANTERN_TILE_STRIDE uints per screen tile: lantern count then lantern indices.
+  // Filled each frame by m_lanternTileCompPipeline, resized with the output image.
+  nvvk::Buffer m_lanternTileBuffer;
+
   // Push constant for ray tracer.
   PushConstantRay m_pcRay{};
 
@@ -228,6 +251,14 @@ public:
   // so that I can see the screen rectangle coverage.
   bool m_lanternDebug = false;
 
+  // Copied to RtPushConstant::lanternTiles. If true, the lanterns are binned
+  // per screen tile and added in the global pass, instead of one trace per lantern.
+  bool m_lanternTiles = false;
+
+  // If true, only the lanterns visible in the frame read back run their pass. A lantern
+  // entering the view is lit m_lanternVisibleSlots frames late, so this is off by default.
+  bool m_skipHiddenLanterns = false;
+
 
   // Push constant for compute shader filling lantern indirect buffer.
   // Barely fits in 128-byte push constant limit guaranteed by spec.
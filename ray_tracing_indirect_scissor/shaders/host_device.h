@@ -49,10 +49,17 @@ END_BINDING();
 START_BINDING(RtxBindings)
   eTlas     = 0,  // Top-level acceleration structure
   eOutImage = 1,  // Ray tracer output image
-  eLanterns = 2   // All lanterns
+  eLanterns     = 2,  // All lanterns
+  eLanternTiles = 3   // Lanterns reaching each screen tile, see LANTERN_TILE_SIZE
 END_BINDING();
 // clang-format on
 
+// Clustered lighting: the screen is split in tiles of LANTERN_TILE_SIZE^2 pixels, each one
+// storing the count of the lanterns whose scissor rectangle overlaps it, then their indices.
+#define LANTERN_TILE_SIZE 16
+#define LANTERN_TILE_MAX 127                        // Lanterns kept for a tile
+#define LANTERN_TILE_STRIDE (LANTERN_TILE_MAX + 1)  // uints per tile
+
 
 // Information of a obj model when referenced in a shader
 struct ObjDesc
@@ -102,6 +109,10 @@ struct PushConstantRay
 
   // See m_lanternDebug.
   int lanternDebug;
+
+  // See m_lanternTiles. If set, the global pass also adds the light of the lanterns
+  // overlapping the pixel tile, and there are no lantern passes.
+  int lanternTiles;
 };
 
 struct Vertex  // See ObjLoader, copy of VertexObj, could be compressed for device
@@ -186,9 +186,26 @@ void HelloVulkan::createGraphicsPipeline()
 
 //--------------------------------------------------------------------------------------------------
 // Loading the OBJ file and setting up all buffers
+// - Returns the index of the model referenced by the new instance
+// - A path already loaded only adds an instance of the existing model
 //
-void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform)
+uint32_t HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform)
 {
+  if(m_shareRepeatedModels)
+  {
+    // Keyed by path only: materials and textures are resolved relative to the OBJ directory,
+    // so identical files in different folders are different models
+    auto found = m_objModelRegistry.find(filename);
+    if(found != m_objModelRegistry.end())
+    {
+      ObjInstance instance;
+      instance.transform = transform;
+      instance.objIndex  = found->second;
+      m_instances.push_back(instance);
+      return found->second;
+    }
+  }
+
   LOGI("Loading File:  %s \n", filename.c_str());
   ObjLoader loader;
   loader.loadModel(filename);
@@ -244,6 +261,13 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   // Keeping the obj host model and device description
   m_objModel.emplace_back(model);
   m_objDesc.emplace_back(desc);
+
+  if(m_shareRepeatedModels)
+  {
+    m_objModelRegistry[filename] = instance.objIndex;
+  }
+
+  return instance.objIndex;
 }
 
 
@@ -368,6 +392,7 @@ void HelloVulkan::destroyResources()
     m_alloc.destroy(m.matColorBuffer);
     m_alloc.destroy(m.matIndexBuffer);
   }
+  m_objModelRegistry.clear();
 
   for(auto& t : m_textures)
   {
@@ -657,7 +682,9 @@ void HelloVulkan::createBottomLevelAS()
     // We could add more geometry in each BLAS, but we add only one for now
     allBlas.emplace_back(blas);
   }
-  m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+  // The geometry is static: compacting the BLAS after the build
+  m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                                     | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -38,13 +38,15 @@ using Allocator = nvvk::ResourceAllocatorVma;
 using Allocator = nvvk::ResourceAllocatorDedicated;
 #endif
 
+#include <unordered_map>
+
 #include "nvvk/appbase_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
 #include "shaders/host_device.h"
 
 // #VKRay
-#include "nvvk/raytraceKHR_vk.hpp"
+#include "raytrace_builder.h"
 #include "nvvk/sbtwrapper_vk.hpp"
 
 //--------------------------------------------------------------------------------------------------
@@ -60,13 +62,14 @@ public:
   void setup(const VkInstance& instance, const VkDevice& device, const VkPhysicalDevice& physicalDevice, uint32_t queueFamily) override;
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
-  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1));
+  uint32_t loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1));
   void updateDescriptorSet();
   void createUniformBuffer();
   void createObjDescriptionBuffer();
   void createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures);
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
@@ -102,6 +105,12 @@ public:
   std::vector<ObjDesc>     m_objDesc;    // Model description for device access
   std::vector<ObjInstance> m_instances;  // Scene model instances
 
+  // Models already loaded, keyed by file path.
+  // When enabled, loading the same file again only adds an instance of the existing model,
+  // sharing its buffers, textures and BLAS.
+  bool                                      m_shareRepeatedModels{true};
+  std::unordered_map<std::string, uint32_t> m_objModelRegistry;  // Path -> model
+
 
   // Graphic pipeline
   VkPipelineLayout            m_pipelineLayout;
@@ -154,7 +163,7 @@ public:
 
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-  nvvk::RaytracingBuilderKHR                      m_rtBuilder;
+  RaytracingBuilder                               m_rtBuilder;
   nvvk::DescriptorSetBindings                     m_rtDescSetLayoutBind;
   VkDescriptorPool                                m_rtDescPool;
   VkDescriptorSetLayout                           m_rtDescSetLayout;
@@ -685,10 +685,9 @@ auto HelloVulkan::sphereToVkGeometryKHR()
 //--------------------------------------------------------------------------------------------------
 // Creating all spheres
 //
-void HelloVulkan::createSpheres(uint32_t nbSpheres)
+void HelloVulkan::createSpheres(uint32_t nbSpheres, uint32_t seed)
 {
-  std::random_device                    rd{};
-  std::mt19937                          gen{rd()};
+  std::mt19937                          gen{seed};
   std::normal_distribution<float>       xzd{0.f, 5.f};
   std::normal_distribution<float>       yd{6.f, 3.f};
   std::uniform_real_distribution<float> radd{.05f, .2f};
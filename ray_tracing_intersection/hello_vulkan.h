@@ -49,6 +49,7 @@ public:
   void createTextureImages(const VkCommandBuffer& cmdBuf, const std::vector<std::string>& textures);
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
   void onResize(int /*w*/, int /*h*/) override;
+  void setSize(const VkExtent2D& size) { m_size = size; }  // Rendering size without swapchain (headless)
   void destroyResources();
   void rasterize(const VkCommandBuffer& cmdBuff);
 
@@ -161,6 +162,6 @@ public:
   nvvk::Buffer        m_spheresMatColorBuffer;  // Multiple materials
   nvvk::Buffer        m_spheresMatIndexBuffer;  // Define which sphere uses which material
 
-  void createSpheres(uint32_t nbSpheres);
+  void createSpheres(uint32_t nbSpheres, uint32_t seed);
   auto sphereToVkGeometryKHR();
 };